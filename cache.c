@@ -0,0 +1,185 @@
+/* Copyright 2021 <> */
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "utils.h"
+
+// Entries of a set, the bits of referenced
+#define CACHE_WAYS 8
+// Bits of the doorkeeper for every entry
+#define SEEN_BITS 8
+
+typedef struct cache_entry {
+	unsigned int key_len;
+	unsigned int value_len;
+	int server_id;
+	char *value;
+	char key[CACHE_KEY_MAX];
+} cache_entry;
+
+// The state of a set fills its first cache line, so a lookup or an
+// eviction reads a single line before it compares any key
+typedef struct cache_set {
+	unsigned int hashes[CACHE_WAYS];
+	// The set is empty unless this is the generation of the cache
+	unsigned int generation;
+	unsigned char used;  // Bit i: entry i holds a key
+	unsigned char referenced;  // Bit i: entry i was read since the hand passed
+	unsigned char hand;  // Next entry looked at by CLOCK
+	char pad[64 - CACHE_WAYS * sizeof(unsigned int) - sizeof(unsigned int) - 3];
+	cache_entry entries[CACHE_WAYS];
+} cache_set;
+
+struct read_cache {
+	cache_set *sets;
+	unsigned int mask;  // Number of sets - 1
+	// Doorkeeper: a bit per key hash which missed lately. A key is only
+	// admitted on its second miss, so the keys read once don't push the
+	// hot ones out. It is emptied once half of its bits are set
+	unsigned long long *seen;
+	unsigned int seen_mask;  // Number of bits - 1
+	unsigned int seen_set;
+	// Bumped to drop every entry at once (0 is never used)
+	unsigned int generation;
+	unsigned long long hits;
+	unsigned long long misses;
+};
+
+read_cache* cache_create(unsigned int entries) {
+	read_cache *cache = calloc(1, sizeof(read_cache));
+	DIE(cache == NULL, "Error allocating read cache");
+
+	unsigned int sets = 1;
+	while (sets * CACHE_WAYS < entries)
+		sets *= 2;
+	cache->sets = aligned_alloc(64, sets * sizeof(cache_set));
+	DIE(cache->sets == NULL, "Error allocating read cache");
+	memset(cache->sets, 0, sets * sizeof(cache_set));
+	cache->mask = sets - 1;
+	cache->generation = 1;
+
+	unsigned int bits = sets * CACHE_WAYS * SEEN_BITS;
+	cache->seen = calloc(bits / 64, sizeof(unsigned long long));
+	DIE(cache->seen == NULL, "Error allocating read cache");
+	cache->seen_mask = bits - 1;
+	return cache;
+}
+
+static cache_set* cache_set_of(read_cache* cache, unsigned int hash) {
+	// the ring uses the high bits of the hash, the sets mix in the low ones
+	return &cache->sets[(hash ^ (hash >> 16)) & cache->mask];
+}
+
+// Returns the entry of a set which holds a key or -1
+static int cache_slot(read_cache* cache, cache_set* set, const char* key,
+					unsigned int key_len, unsigned int hash) {
+	if (set->generation != cache->generation)
+		return -1;
+	for (int i = 0; i < CACHE_WAYS; i++) {
+		cache_entry *entry = &set->entries[i];
+
+		if ((set->used & (1u << i)) && set->hashes[i] == hash &&
+			entry->key_len == key_len && !memcmp(entry->key, key, key_len))
+			return i;
+	}
+	return -1;
+}
+
+char* cache_find(read_cache* cache, const char* key, unsigned int key_len,
+				unsigned int hash, int* server_id, unsigned int* value_len) {
+	cache_set *set = cache_set_of(cache, hash);
+	int i = key_len <= CACHE_KEY_MAX ?
+			cache_slot(cache, set, key, key_len, hash) : -1;
+
+	if (i < 0) {
+		cache->misses++;
+		return NULL;
+	}
+	cache->hits++;
+	set->referenced |= 1u << i;
+	*server_id = set->entries[i].server_id;
+	*value_len = set->entries[i].value_len;
+	return set->entries[i].value;
+}
+
+void cache_insert(read_cache* cache, const char* key, unsigned int key_len,
+				unsigned int hash, char* value, unsigned int value_len,
+				int server_id) {
+	if (key_len > CACHE_KEY_MAX)
+		return;
+	unsigned int bit = (hash * 2654435761u) & cache->seen_mask;
+	unsigned long long *word = &cache->seen[bit / 64];
+	if (!(*word & (1ull << (bit % 64)))) {
+		*word |= 1ull << (bit % 64);
+		if (++cache->seen_set > cache->seen_mask / 2) {
+			memset(cache->seen, 0, (cache->seen_mask + 1) / 8);
+			cache->seen_set = 0;
+		}
+		return;
+	}
+
+	cache_set *set = cache_set_of(cache, hash);
+	int i = cache_slot(cache, set, key, key_len, hash);
+	if (set->generation != cache->generation) {
+		// the set was dropped by cache_clear()
+		set->generation = cache->generation;
+		set->used = 0;
+		set->referenced = 0;
+	}
+
+	// an unused entry is taken first, then the hand skips (and clears)
+	// the entries which were read since it last passed them
+	if (i < 0 && set->used != (1u << CACHE_WAYS) - 1)
+		i = __builtin_ctz(~set->used);
+	if (i < 0) {
+		while (set->referenced & (1u << set->hand)) {
+			set->referenced &= ~(1u << set->hand);
+			set->hand = (set->hand + 1) % CACHE_WAYS;
+		}
+		i = set->hand;
+		set->hand = (set->hand + 1) % CACHE_WAYS;
+	}
+
+	cache_entry *entry = &set->entries[i];
+	set->hashes[i] = hash;
+	set->used |= 1u << i;
+	set->referenced &= ~(1u << i);
+	entry->key_len = key_len;
+	entry->server_id = server_id;
+	entry->value_len = value_len;
+	entry->value = value;
+	memcpy(entry->key, key, key_len);
+}
+
+void cache_invalidate(read_cache* cache, const char* key,
+					unsigned int key_len, unsigned int hash) {
+	if (key_len > CACHE_KEY_MAX)
+		return;
+	cache_set *set = cache_set_of(cache, hash);
+	int i = cache_slot(cache, set, key, key_len, hash);
+
+	if (i >= 0)
+		set->used &= ~(1u << i);
+}
+
+void cache_clear(read_cache* cache) {
+	if (++cache->generation != 0)
+		return;
+	// the generations wrapped, so the old sets are really emptied
+	for (unsigned int s = 0; s <= cache->mask; s++)
+		cache->sets[s].generation = 0;
+	cache->generation = 1;
+}
+
+void cache_counts(read_cache* cache, unsigned long long* hits,
+				unsigned long long* misses) {
+	*hits = cache->hits;
+	*misses = cache->misses;
+}
+
+void cache_free(read_cache* cache) {
+	free(cache->seen);
+	free(cache->sets);
+	free(cache);
+}
@@ -0,0 +1,63 @@
+/* Copyright 2021 <> */
+#ifndef CACHE_H_
+#define CACHE_H_
+
+// Longest key kept by the read cache (longer keys are never cached)
+#define CACHE_KEY_MAX 64
+
+typedef struct read_cache read_cache;
+
+/**
+ * cache_create() - Creates a read cache of hot keys.
+ * @arg1: Number of entries (rounded up to a power of 2, at least 8).
+ *
+ * The cache is split in sets of 8 entries picked by the key hash. A
+ * set evicts with CLOCK: an entry which was read since the hand last
+ * passed gets a second chance.
+ */
+read_cache* cache_create(unsigned int entries);
+
+/**
+ * cache_find() - Looks a key up in the cache.
+ * @arg1: Cache.
+ * @arg2: Key (it doesn't have to end with '\0').
+ * @arg3: Length of the key.
+ * @arg4: Hash of the key.
+ * @arg5: This function will RETURN the server ID via this parameter.
+ * @arg6: This function will RETURN the length of the value via this
+ *        parameter.
+ *
+ * Return: the value of the key on its server, or NULL if it is not cached.
+ */
+char* cache_find(read_cache* cache, const char* key, unsigned int key_len,
+				unsigned int hash, int* server_id, unsigned int* value_len);
+
+/**
+ * cache_insert() - Remembers where the value of a key is.
+ * @arg1: Cache.
+ * @arg2: Key.
+ * @arg3: Length of the key.
+ * @arg4: Hash of the key.
+ * @arg5: Value, as returned by the server (it is not copied, so the key
+ *        has to be invalidated before the object changes or moves).
+ * @arg6: Length of the value.
+ * @arg7: ID of the server which stores it.
+ */
+void cache_insert(read_cache* cache, const char* key, unsigned int key_len,
+				unsigned int hash, char* value, unsigned int value_len,
+				int server_id);
+
+// Drops a key from the cache (after it was stored again)
+void cache_invalidate(read_cache* cache, const char* key,
+					unsigned int key_len, unsigned int hash);
+
+// Drops every key at once (after keys moved between servers)
+void cache_clear(read_cache* cache);
+
+// Returns the number of lookups which found and didn't find their key
+void cache_counts(read_cache* cache, unsigned long long* hits,
+				unsigned long long* misses);
+
+void cache_free(read_cache* cache);
+
+#endif  /* CACHE_H_ */
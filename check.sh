@@ -111,6 +111,35 @@ function check_test() {
     rm -f time.err
 }
 
+# Runs an input of the extra checks with some options of the driver and
+# compares the result with a ref. They are not graded. Usage:
+# check_extra_test <input> <ref> [options of the driver]
+function check_extra_test() {
+    input_name=$1
+    ref_name=$2
+    shift 2
+    out_path="out/$input_name$(echo "$@" | tr -d ' -').out"
+
+    echo -n "Extra: $input_name $@ ...................... "
+    timeout 5 ./$EXEC in/$input_name.in "$@" > $out_path 2> /dev/null
+    if [ "$?" != "0" ]; then
+        echo "FAILED (exit code or timeout)"
+        EXTRA_FAILED=$(($EXTRA_FAILED+1))
+        return
+    fi
+
+    diff -bB -i ref/$ref_name.ref $out_path 2>&1 1> my_diff
+    if test $? -eq 0; then
+        echo "PASS"
+    else
+        echo "FAILED"
+        echo "Diff result:"
+        cat my_diff | tail -n 10
+        EXTRA_FAILED=$(($EXTRA_FAILED+1))
+    fi
+    rm -f my_diff
+}
+
 function checkBonus {
     printf '%*s\n' "${COLUMNS:-$(($(tput cols) - $ONE))}" '' | tr ' ' -
     echo "" > checkstyle.txt
@@ -161,6 +190,35 @@ done
 echo "TOTAL: $TOTAL/80"
 echo ""
 
+# Behaviour of the driver the graded tests don't reach
+EXTRA_FAILED=0
+# an add of a server which is there and a remove of a missing one are
+# ignored
+check_extra_test servers_twice servers_twice
+# stats prints the metrics between the results (the counters are off in
+# this build)
+check_extra_test stats stats
+# --no-values leaves the values out of the results
+check_extra_test test7 test7_no_values --no-values
+# --threads N applies the requests on a pipeline, the results must still
+# come out in the order of the requests
+for threads in 1 4; do
+    for ((i=1;i<=$NO_TESTS;i++)); do
+        check_extra_test test$i test$i --threads $threads
+    done
+done
+
+# The counters are only kept with LB_STATS=1, every load balancer has its
+# own ones
+make clean &> /dev/null
+make check LB_STATS=1 &> /dev/null
+for check in check_stats check_snapshot; do
+    echo "Extra: $check"
+    ./$check || EXTRA_FAILED=$(($EXTRA_FAILED+1))
+done
+echo "EXTRA FAILED: $EXTRA_FAILED"
+echo ""
+
 checkBonus
 printBonus
 
@@ -0,0 +1,63 @@
+#!/bin/bash
+# Checks that lb_net stays up when a client sends requests the load
+# balancer can't apply: a server added twice, a missing server removed and
+# stores and retrieves after every server is removed. Run it where
+# check.sh runs (next to the sources and the Makefile)
+EXEC=lb_net
+PORT=${PORT:-7171}
+FAILED=0
+
+make net > /dev/null || exit 1
+
+./$EXEC --port $PORT --servers 1 2> lb_net.err &
+SERVER_PID=$!
+trap 'kill $SERVER_PID 2> /dev/null; rm -f lb_net.err' EXIT
+
+# Wait until the port is open
+for ((i = 0; i < 50; i++)); do
+    (exec 3<> /dev/tcp/127.0.0.1/$PORT) 2> /dev/null && break
+    sleep 0.1
+done
+
+# Sends the requests on a new connection and prints every line the
+# server sends back, until it closes the connection
+function send_requests() {
+    exec 3<> /dev/tcp/127.0.0.1/$PORT || return 1
+    printf "$1" >&3
+    timeout 1 cat <&3
+    exec 3<&-
+}
+
+function check() {
+    name=$1
+    expected=$2
+    got=$3
+
+    echo -n "Test: $name ...................... "
+    if [ "$got" == "$expected" ] && kill -0 $SERVER_PID 2> /dev/null; then
+        echo "PASS"
+    else
+        echo "FAILED"
+        echo "Expected: $expected"
+        echo "Got: $got"
+        FAILED=1
+    fi
+}
+
+got=$(send_requests 'add_server 0\nstore "k1" "v1"\nretrieve "k1"\n')
+check "add twice" $'Stored v1 on server 0.\nRetrieved v1 from server 0.' "$got"
+
+got=$(send_requests 'remove_server 7\nretrieve "k1"\n')
+check "remove missing" "Retrieved v1 from server 0." "$got"
+
+# The connection is closed at the store, after the result before it
+got=$(send_requests 'retrieve "k1"\nremove_server 0\nstore "k2" "v2"\nretrieve "k1"\n')
+check "store without servers" "Retrieved v1 from server 0." "$got"
+
+got=$(send_requests 'retrieve "k1"\n')
+check "retrieve without servers" "" "$got"
+
+got=$(send_requests 'add_server 3\nstore "k3" "v3"\nretrieve "k3"\n')
+check "add after" $'Stored v3 on server 3.\nRetrieved v3 from server 3.' "$got"
+
+exit $FAILED
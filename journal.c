@@ -0,0 +1,440 @@
+/* Copyright 2021 <> */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "utils.h"
+
+// A journal starts with the magic, then every record is its checksum,
+// the length of its payload and the payload (the type and the fields)
+#define JOURNAL_MAGIC "LBJOURN1"
+#define MAGIC_SIZE 8
+#define RECORD_HEADER 8
+// The records are written as soon as this much is buffered, and the
+// appends wait for the disk when 8 times as much is
+#define FLUSH_SIZE (1u << 20)
+#define MAX_BUFFERED (8 * FLUSH_SIZE)
+#define BUFFER_INIT (64u << 10)
+#define COPY_CHUNK (1u << 20)
+
+struct journal {
+	int fd;
+	char *path;
+	unsigned int sync_us;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;  // The flusher has records to write (or stops)
+	pthread_cond_t synced;  // More records reached the disk
+	// Records which are not written yet
+	char *data;
+	size_t used;
+	size_t cap;
+	// Records being written by the flusher, outside the lock
+	char *spare;
+	size_t spare_cap;
+	unsigned long long appended;  // Bytes appended since the open
+	unsigned long long durable;  // Bytes of them written and synced
+	unsigned long long size;  // Size of the file with the buffered records
+	unsigned long long first_ns;  // When the oldest buffered record came
+	int waiters;  // Threads in journal_wait()
+	int flushing;
+	int stop;
+	pthread_t flusher;
+};
+
+// CRC-32C (Castagnoli), one table lookup per byte
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0x82f63b78u & -(crc & 1));
+		crc_table[i] = crc;
+	}
+}
+
+static uint32_t crc32c(const char *data, size_t len) {
+	const unsigned char *p = (const unsigned char *)data;
+	uint32_t crc = 0xffffffffu;
+
+	while (len--)
+		crc = (crc >> 8) ^ crc_table[(crc ^ *p++) & 0xff];
+	return ~crc;
+}
+
+static unsigned long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void write_all(int fd, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t done = write(fd, data, len);
+
+		if (done < 0 && errno == EINTR)
+			continue;
+		DIE(done < 0, "Error writing journal");
+		data += done;
+		len -= done;
+	}
+}
+
+static size_t payload_size(const journal_record *record) {
+	switch (record->type) {
+	case JOURNAL_STORE:
+		return 1 + 8 + (size_t)record->key_len + record->value_len;
+	case JOURNAL_ADD_SERVER:
+		return 1 + 8;
+	default:
+		return 1 + 4;
+	}
+}
+
+static void put_u32(char **p, uint32_t value) {
+	memcpy(*p, &value, sizeof(value));
+	*p += sizeof(value);
+}
+
+static uint32_t get_u32(const char **p) {
+	uint32_t value;
+
+	memcpy(&value, *p, sizeof(value));
+	*p += sizeof(value);
+	return value;
+}
+
+// Writes a whole record (header and payload) to out
+static void encode(const journal_record *record, char *out) {
+	size_t len = payload_size(record);
+	char *p = out + RECORD_HEADER;
+
+	*p++ = (char)record->type;
+	if (record->type == JOURNAL_STORE) {
+		put_u32(&p, record->key_len);
+		put_u32(&p, record->value_len);
+		memcpy(p, record->key, record->key_len);
+		memcpy(p + record->key_len, record->value, record->value_len);
+	} else {
+		put_u32(&p, (uint32_t)record->server_id);
+		if (record->type == JOURNAL_ADD_SERVER)
+			put_u32(&p, record->vnodes);
+	}
+
+	p = out;
+	put_u32(&p, crc32c(out + RECORD_HEADER, len));
+	put_u32(&p, (uint32_t)len);
+}
+
+// Reads the payload of a record, returns 0 if it is not well formed
+static int decode(const char *p, uint32_t len, journal_record *record) {
+	const char *end = p + len;
+
+	memset(record, 0, sizeof(journal_record));
+	if (len < 1)
+		return 0;
+	record->type = (unsigned char)*p++;
+	switch (record->type) {
+	case JOURNAL_STORE:
+		if (len < 9)
+			return 0;
+		record->key_len = get_u32(&p);
+		record->value_len = get_u32(&p);
+		if ((unsigned long long)record->key_len + record->value_len !=
+			(unsigned long long)(end - p))
+			return 0;
+		record->key = p;
+		record->value = p + record->key_len;
+		return 1;
+	case JOURNAL_ADD_SERVER:
+		if (len != 9)
+			return 0;
+		record->server_id = (int)get_u32(&p);
+		record->vnodes = get_u32(&p);
+		return 1;
+	case JOURNAL_REMOVE_SERVER:
+		if (len != 5)
+			return 0;
+		record->server_id = (int)get_u32(&p);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+long long journal_replay(const char *path,
+						void (*apply)(const journal_record*, void*),
+						void *arg) {
+	DIE(path == NULL || apply == NULL, "No journal to replay");
+	pthread_once(&crc_once, crc_init);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -1;
+	struct stat st;
+	DIE(fstat(fd, &st) != 0, "Error reading journal");
+	if (st.st_size < MAGIC_SIZE) {
+		close(fd);
+		return 0;  // the journal was being created
+	}
+
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	DIE(map == MAP_FAILED, "Error mapping journal");
+	if (memcmp(map, JOURNAL_MAGIC, MAGIC_SIZE) != 0) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	unsigned long long pos = MAGIC_SIZE, size = st.st_size;
+	while (size - pos >= RECORD_HEADER) {
+		const char *p = map + pos;
+		uint32_t crc = get_u32(&p);
+		uint32_t len = get_u32(&p);
+		journal_record record;
+
+		if (len > size - pos - RECORD_HEADER || crc32c(p, len) != crc ||
+			!decode(p, len, &record))
+			break;  // the rest was not fully written
+		apply(&record, arg);
+		pos += RECORD_HEADER + len;
+	}
+	munmap(map, st.st_size);
+	return pos;
+}
+
+static void* flusher_run(void *arg) {
+	journal *j = arg;
+
+	pthread_mutex_lock(&j->lock);
+	while (1) {
+		while (j->used == 0 && !j->stop)
+			pthread_cond_wait(&j->wake, &j->lock);
+		if (j->used == 0)
+			break;  // stopped, with nothing left to write
+
+		// Group commit: more records join the write until the oldest one
+		// waited sync_us, unless the buffer is big or a thread waits
+		unsigned long long deadline = j->first_ns + j->sync_us * 1000ull;
+		while (!j->stop && !j->waiters && j->used < FLUSH_SIZE &&
+			now_ns() < deadline) {
+			struct timespec ts = {deadline / 1000000000ull,
+								deadline % 1000000000ull};
+
+			pthread_cond_timedwait(&j->wake, &j->lock, &ts);
+		}
+
+		char *data = j->data;
+		size_t len = j->used, cap = j->cap;
+		unsigned long long target = j->appended;
+		j->data = j->spare;
+		j->cap = j->spare_cap;
+		j->spare = data;
+		j->spare_cap = cap;
+		j->used = 0;
+		j->flushing = 1;
+		pthread_mutex_unlock(&j->lock);
+
+		write_all(j->fd, data, len);
+		DIE(fdatasync(j->fd) != 0, "Error syncing journal");
+
+		pthread_mutex_lock(&j->lock);
+		j->flushing = 0;
+		j->durable = target;
+		pthread_cond_broadcast(&j->synced);
+	}
+	pthread_mutex_unlock(&j->lock);
+	return NULL;
+}
+
+// Makes a rename in the directory of a file durable
+static void sync_dir(const char *path) {
+	char *dir = strdup(path);
+	DIE(dir == NULL, "Error allocating journal path");
+	char *slash = strrchr(dir, '/');
+
+	if (slash == NULL)
+		strcpy(dir, ".");
+	else if (slash == dir)
+		dir[1] = '\0';
+	else
+		*slash = '\0';
+	int fd = open(dir, O_RDONLY);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	free(dir);
+}
+
+journal* journal_open(const char *path, long long valid, unsigned int sync_us) {
+	DIE(path == NULL, "No journal path");
+	pthread_once(&crc_once, crc_init);
+	journal *j = calloc(1, sizeof(journal));
+	DIE(j == NULL, "Error allocating journal");
+	j->path = strdup(path);
+	DIE(j->path == NULL, "Error allocating journal path");
+	j->sync_us = sync_us;
+
+	j->fd = open(path, O_RDWR | O_CREAT, 0644);
+	DIE(j->fd < 0, "Error opening journal");
+	if (valid < MAGIC_SIZE) {
+		// a new journal
+		DIE(ftruncate(j->fd, 0) != 0, "Error creating journal");
+		write_all(j->fd, JOURNAL_MAGIC, MAGIC_SIZE);
+		DIE(fsync(j->fd) != 0, "Error creating journal");
+		sync_dir(path);
+		valid = MAGIC_SIZE;
+	} else {
+		// the torn tail of a crash is cut off
+		DIE(ftruncate(j->fd, valid) != 0, "Error truncating journal");
+	}
+	DIE(lseek(j->fd, 0, SEEK_END) < 0, "Error opening journal");
+	j->size = valid;
+
+	j->cap = j->spare_cap = BUFFER_INIT;
+	j->data = malloc(j->cap);
+	j->spare = malloc(j->spare_cap);
+	DIE(j->data == NULL || j->spare == NULL, "Error allocating journal");
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	DIE(pthread_mutex_init(&j->lock, NULL) ||
+		pthread_cond_init(&j->wake, &attr) ||
+		pthread_cond_init(&j->synced, NULL), "Error creating journal locks");
+	pthread_condattr_destroy(&attr);
+	DIE(pthread_create(&j->flusher, NULL, flusher_run, j),
+		"Error starting journal thread");
+	return j;
+}
+
+unsigned long long journal_append(journal *j, const journal_record *record) {
+	DIE(j == NULL || record == NULL, "No journal");
+	size_t len = RECORD_HEADER + payload_size(record);
+
+	pthread_mutex_lock(&j->lock);
+	// the disk is too far behind, wait for the flusher to catch up
+	while (j->used >= MAX_BUFFERED)
+		pthread_cond_wait(&j->synced, &j->lock);
+	if (j->used + len > j->cap) {
+		while (j->used + len > j->cap)
+			j->cap *= 2;
+		j->data = realloc(j->data, j->cap);
+		DIE(j->data == NULL, "Error growing journal buffer");
+	}
+	if (j->used == 0)
+		j->first_ns = now_ns();
+
+	encode(record, j->data + j->used);
+	j->used += len;
+	j->appended += len;
+	j->size += len;
+	unsigned long long position = j->appended;
+	// the flusher sleeps while the buffer is empty
+	if (j->used == len || j->used >= FLUSH_SIZE)
+		pthread_cond_signal(&j->wake);
+	pthread_mutex_unlock(&j->lock);
+	return position;
+}
+
+void journal_wait(journal *j, unsigned long long position) {
+	DIE(j == NULL, "No journal");
+	pthread_mutex_lock(&j->lock);
+	if (j->durable < position) {
+		j->waiters++;
+		pthread_cond_signal(&j->wake);
+		while (j->durable < position)
+			pthread_cond_wait(&j->synced, &j->lock);
+		j->waiters--;
+	}
+	pthread_mutex_unlock(&j->lock);
+}
+
+void journal_sync(journal *j) {
+	DIE(j == NULL, "No journal");
+	pthread_mutex_lock(&j->lock);
+	unsigned long long position = j->appended;
+	pthread_mutex_unlock(&j->lock);
+	journal_wait(j, position);
+}
+
+unsigned long long journal_size(journal *j) {
+	DIE(j == NULL, "No journal");
+	pthread_mutex_lock(&j->lock);
+	unsigned long long size = j->size;
+	pthread_mutex_unlock(&j->lock);
+	return size;
+}
+
+void journal_discard(journal *j, unsigned long long size) {
+	DIE(j == NULL, "No journal");
+	pthread_mutex_lock(&j->lock);
+	DIE(size < MAGIC_SIZE || size > j->size, "Error - not a journal position");
+	while (j->flushing)
+		pthread_cond_wait(&j->synced, &j->lock);
+
+	// the buffered records are written first, so the file holds them all
+	write_all(j->fd, j->data, j->used);
+	DIE(fdatasync(j->fd) != 0, "Error syncing journal");
+	j->used = 0;
+	j->durable = j->appended;
+	pthread_cond_broadcast(&j->synced);
+
+	// the kept records are copied to a new file which replaces the old one
+	char *tmp = malloc(strlen(j->path) + sizeof(".tmp"));
+	char *chunk = malloc(COPY_CHUNK);
+	DIE(tmp == NULL || chunk == NULL, "Error allocating journal copy");
+	sprintf(tmp, "%s.tmp", j->path);
+	int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	DIE(fd < 0, "Error creating journal");
+	write_all(fd, JOURNAL_MAGIC, MAGIC_SIZE);
+	for (unsigned long long pos = size; pos < j->size;) {
+		ssize_t done = pread(j->fd, chunk, COPY_CHUNK, pos);
+
+		if (done < 0 && errno == EINTR)
+			continue;
+		DIE(done <= 0, "Error copying journal");
+		write_all(fd, chunk, done);
+		pos += done;
+	}
+	DIE(fdatasync(fd) != 0, "Error syncing journal");
+	DIE(rename(tmp, j->path) != 0, "Error replacing journal");
+	sync_dir(j->path);
+	close(j->fd);
+	j->fd = fd;
+	j->size = MAGIC_SIZE + (j->size - size);
+	pthread_mutex_unlock(&j->lock);
+	free(chunk);
+	free(tmp);
+}
+
+void journal_close(journal *j) {
+	DIE(j == NULL, "No journal");
+	pthread_mutex_lock(&j->lock);
+	j->stop = 1;
+	pthread_cond_signal(&j->wake);
+	pthread_mutex_unlock(&j->lock);
+	pthread_join(j->flusher, NULL);
+
+	close(j->fd);
+	pthread_mutex_destroy(&j->lock);
+	pthread_cond_destroy(&j->wake);
+	pthread_cond_destroy(&j->synced);
+	free(j->data);
+	free(j->spare);
+	free(j->path);
+	free(j);
+}
@@ -0,0 +1,93 @@
+/* Copyright 2021 <> */
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+typedef struct journal journal;
+
+typedef enum journal_type {
+	JOURNAL_STORE = 1,
+	JOURNAL_ADD_SERVER,
+	JOURNAL_REMOVE_SERVER
+} journal_type;
+
+// A record of the journal. When it is replayed, the key and the value
+// point inside the file (they don't end with '\0')
+typedef struct journal_record {
+	journal_type type;
+	int server_id;
+	unsigned int vnodes;  // Copies of an added server
+	const char *key;
+	unsigned int key_len;
+	const char *value;
+	unsigned int value_len;
+} journal_record;
+
+/**
+ * journal_replay() - Reads the records of a journal in order.
+ * @arg1: Path of the journal.
+ * @arg2: Function called for every record.
+ * @arg3: Argument passed to the function.
+ *
+ * The replay stops at the first record which is cut short or whose
+ * checksum is wrong (the tail of a crash).
+ * Return: the size of the valid part of the file, 0 if there is no
+ * journal yet, or -1 if the file is not a journal.
+ */
+long long journal_replay(const char *path,
+						void (*apply)(const journal_record*, void*),
+						void *arg);
+
+/**
+ * journal_open() - Opens a journal to append records to it.
+ * @arg1: Path of the journal (created if it doesn't exist).
+ * @arg2: Size of its valid part (the rest is cut off).
+ * @arg3: Longest time, in microseconds, a record waits before it is
+ *        synced to the disk.
+ *
+ * A thread writes and syncs the records in the background, all the
+ * records appended while it waits share one fdatasync (group commit).
+ */
+journal* journal_open(const char *path, long long valid, unsigned int sync_us);
+
+/**
+ * journal_append() - Appends a record to a journal.
+ * @arg1: Journal.
+ * @arg2: Record (the key and the value are copied).
+ *
+ * Return: the position to wait for with journal_wait() to know that
+ * the record reached the disk.
+ */
+unsigned long long journal_append(journal *j, const journal_record *record);
+
+/**
+ * journal_wait() - Waits until the records before a position are synced.
+ * @arg1: Journal.
+ * @arg2: Position returned by journal_append().
+ */
+void journal_wait(journal *j, unsigned long long position);
+
+// Waits until every record appended so far is synced
+void journal_sync(journal *j);
+
+/**
+ * journal_size() - Returns the size the file has once the records are
+ *                  written.
+ * @arg1: Journal.
+ */
+unsigned long long journal_size(journal *j);
+
+/**
+ * journal_discard() - Drops the start of a journal.
+ * @arg1: Journal.
+ * @arg2: Size returned by journal_size(): the records before it are
+ *        dropped, the ones appended after it are kept.
+ *
+ * Used once a snapshot holds the effect of the dropped records. The
+ * kept records are copied to a new file which replaces the journal.
+ */
+void journal_discard(journal *j, unsigned long long size);
+
+// Writes and syncs the last records, then closes the journal
+void journal_close(journal *j);
+
+#endif  /* JOURNAL_H_ */
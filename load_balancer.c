@@ -1,29 +1,184 @@
 /* Copyright 2021 <Dinica Mihnea-Gabriel 313CA> */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "load_balancer.h"
+#include "cache.h"
+#include "journal.h"
+#include "routing.h"
+#include "stats.h"
 #include "utils.h"
 
-#define MAX_SIZE 3*(1e5)
+// Initial capacity of the hash ring, it doubles when it gets full
+#define INITIAL_SIZE 16
+// Number of copies (virtual nodes) used by loader_add_server
+#define DEFAULT_REPLICAS 3
+// The tag of a copy is tag_nr * TAG_STRIDE + server_id
+#define TAG_STRIDE 100000
+// Default size of the Maglev lookup table (a prime)
+#define MAGLEV_SIZE 65537
+// Build with -DSLAB_HUGE_PAGES=1 to back the objects with huge pages
+#ifndef SLAB_HUGE_PAGES
+#define SLAB_HUGE_PAGES 0
+#endif
+// Number of threads which can use a thread-safe load balancer at once
+#define MAX_READERS 256
+// Snapshot files start with the magic and the version of their format
+#define SNAPSHOT_MAGIC "LBSNAPSH"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+// Default longest wait of a journal record before it is synced
+#define JOURNAL_SYNC_US 1000
+// Largest number of servers which store the same key
+#define MAX_REPLICAS 16
 
-// struct that will be added in the hash ring to easily identify a server
-struct server_info {
-	unsigned int hash;
-	int server_id;
-	int tag_server;
-	server_memory *server;
-};
+// Immutable copy of the hash ring: in thread-safe mode the readers route
+// against it without locks, and a new one is published on every change
+typedef struct ring_view {
+	unsigned int elements;
+	unsigned int *hashes;
+	int *server_ids;
+	server_memory **servers;
+	lb_stats_set *stats;  // Of the load balancer, for the ring searches
+} ring_view;
+
+// The epoch a thread entered the load balancer at (0 outside), on its
+// own cache line so the readers don't share lines with each other
+typedef struct reader_slot {
+	unsigned long long epoch;
+	char pad[64 - sizeof(unsigned long long)];
+} reader_slot;
+
+static ring_view* view_create(load_balancer* main);
+
+// Slot of the calling thread in the readers of every load balancer. A
+// thread takes the first free slot and gives it back when it exits
+static __thread int reader_id = -1;
+static char reader_taken[MAX_READERS];
+// Highest slot ever taken + 1, the writers only check the slots below it
+static int readers_used;
+static pthread_key_t reader_key;
+static pthread_once_t reader_key_once = PTHREAD_ONCE_INIT;
 
+// The hash ring is kept as parallel arrays sorted by hash (position i of
+// every array describes the same copy of a server)
 struct load_balancer {
-	// Maximum size of the hash ring
+	// Allocated size of the hash ring arrays
 	unsigned int max_size;
 	// Current number of elements (servers + copies)
 	unsigned int elements;
-	// Hash ring array
-	server_info **h_ring;
+	// Hashes of the copies, searched when a key is routed
+	unsigned int *hashes;
+	// ID of the server each copy belongs to
+	int *server_ids;
+	// Memory of the server each copy belongs to
+	server_memory **servers;
+	// Allocator shared by all the servers, so objects can move between
+	// them without being copied
+	slab_allocator *slab;
+
+	// Placement strategy used to route the keys
+	lb_engine engine;
+	// Hash of the keys, on the ring and in the tables of the servers
+	hash_fn hash;
+	// The servers sorted by id, with their weight (number of copies)
+	int *member_ids;
+	server_memory **members;
+	unsigned int *member_weights;
+	unsigned int nmembers;
+	unsigned int members_cap;
+	// Maglev lookup table: the member which owns each slot
+	unsigned int *maglev;
+	unsigned int maglev_size;
+
+	// Bounded loads: a key goes to the first copy after its hash whose
+	// server is under the load cap, so it may spill over a few copies
+	double epsilon;
+	// Furthest copy (counted from the owner) any stored key spilled to
+	unsigned int max_spill;
+	// Servers which store every key (their copies of it are all counted
+	// in keys)
+	unsigned int replicas;
+	// Number of keys stored on all the servers
+	unsigned long long keys;
+	// Number of keys moved between servers by adds and removes
+	unsigned long long moved;
+	// Counters of the operations (NULL unless built with -DLB_STATS)
+	lb_stats_set *stats;
+
+	// Thread-safe mode: readers route against view and lock one server,
+	// add and remove are serialised by topology and publish new views
+	int thread_safe;
+	ring_view *view;
+	pthread_mutex_t topology;
+	// Bumped before a reclamation, a view is freed once no reader is
+	// left in an older epoch
+	unsigned long long epoch;
+	// The view before the current one, while the keys of a change move
+	ring_view *prev;
+	// Bumped every time keys move between servers
+	unsigned long long moves;
+	reader_slot *readers;
+
+	// Snapshot file the servers were restored from (mapped read-only)
+	void *snapshot;
+	size_t snapshot_size;
+
+	// Keys read lately and where their values are (NULL without a cache)
+	read_cache *cache;
+
+	// Journal of the changes, with the snapshot of the last checkpoint
+	journal *journal;
+	char *checkpoint_path;
+	unsigned long long compact_bytes;
+	// Journal size which triggers the next checkpoint, moved on after one
+	// fails so it is tried again once the journal grows that much more
+	unsigned long long compact_at;
+	int checkpointing;  // 1 while a thread takes a checkpoint
 };
 
+// Layout of a snapshot file: the header, the members, the copies of the
+// ring, then the entries and the objects of every member (the sizes of
+// the tables are multiples of 8, so the entries are aligned)
+typedef struct snapshot_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int byte_order;  // The numbers are in the writer's byte order
+	unsigned int engine;
+	unsigned int key_hash;
+	unsigned int maglev_size;
+	unsigned int max_spill;
+	double epsilon;
+	unsigned int nmembers;
+	unsigned int ncopies;
+	unsigned int replicas;
+	unsigned int pad;
+	unsigned long long keys;
+	unsigned long long size;  // Size of the whole file
+} snapshot_header;
+
+typedef struct snapshot_member {
+	int id;
+	unsigned int weight;
+	unsigned int count;  // Number of entries
+	unsigned int pad;
+	unsigned long long offset;  // Where the entries start
+} snapshot_member;
+
+typedef struct snapshot_copy {
+	unsigned int hash;
+	int server_id;
+} snapshot_copy;
+
 unsigned int hash_function_servers(void *a) {
 	unsigned int uint_a = *((unsigned int *)a);
 
@@ -34,325 +189,1932 @@ unsigned int hash_function_servers(void *a) {
 }
 
 unsigned int hash_function_key(void *a) {
-	unsigned char *puchar_a = (unsigned char *) a;
-	unsigned int hash = 5381;
-	int c;
-
-	while ((c = *puchar_a++))
-		hash = ((hash << 5u) + hash) + c;
+	return hash_djb2(a, strlen(a));
+}
 
-	return hash;
+void init_lb_config(lb_config *config) {
+	DIE(config == NULL, "Error - no config");
+	memset(config, 0, sizeof(lb_config));
+	config->engine = LB_ENGINE_RING;
+	config->maglev_size = MAGLEV_SIZE;
+	config->journal_sync_us = JOURNAL_SYNC_US;
+	config->replicas = 1;
 }
 
 load_balancer* init_load_balancer() {
+	lb_config config;
+
+	init_lb_config(&config);
+	return init_load_balancer_config(&config);
+}
+
+// Applies a record of the journal while it is replayed
+static void replay_record(const journal_record *record, void *arg) {
+	load_balancer *main = arg;
+	int server_id;
+
+	if (record->type == JOURNAL_STORE) {
+		loader_store_n(main, record->key, record->key_len, record->value,
+					record->value_len, &server_id);
+	} else if (record->type == JOURNAL_ADD_SERVER) {
+		// the server may already be in the snapshot of a checkpoint, then
+		// the add is refused
+		loader_add_server_weighted(main, record->server_id, record->vnodes);
+	} else {
+		loader_remove_server(main, record->server_id);
+	}
+}
+
+// Rebuilds a load balancer from its last checkpoint and its journal,
+// then opens the journal to append the next changes
+static load_balancer* journal_start(const lb_config *config) {
+	lb_config plain = *config;
+	plain.journal = NULL;
+	char *checkpoint = malloc(strlen(config->journal) + sizeof(".snapshot"));
+	DIE(checkpoint == NULL, "Error allocating checkpoint path");
+	sprintf(checkpoint, "%s.snapshot", config->journal);
+
+	load_balancer *main;
+	if (access(checkpoint, F_OK) == 0) {
+		main = loader_restore(checkpoint, &plain);
+		DIE(main == NULL, "Error - the checkpoint is not a snapshot");
+	} else {
+		main = init_load_balancer_config(&plain);
+	}
+	long long valid = journal_replay(config->journal, replay_record, main);
+	DIE(valid < 0, "Error - not a journal");
+
+	main->journal = journal_open(config->journal, valid,
+								config->journal_sync_us);
+	main->checkpoint_path = checkpoint;
+	main->compact_bytes = config->journal_compact_bytes;
+	main->compact_at = config->journal_compact_bytes;
+	return main;
+}
+
+load_balancer* init_load_balancer_config(const lb_config *config) {
+	DIE(config == NULL, "Error - no config");
+	if (config->journal != NULL)
+		return journal_start(config);
+	DIE(config->engine != LB_ENGINE_RING && config->engine != LB_ENGINE_MAGLEV
+		&& config->engine != LB_ENGINE_JUMP, "Error - unknown engine");
+	DIE(config->key_hash != LB_HASH_DJB2 && config->key_hash != LB_HASH_WY,
+		"Error - unknown key hash");
+	DIE(config->epsilon < 0, "Error - epsilon must not be negative");
+	DIE(config->epsilon > 0 && config->engine != LB_ENGINE_RING,
+		"Error - bounded loads need the ring engine");
+	DIE(config->thread_safe && (config->engine != LB_ENGINE_RING ||
+		config->epsilon > 0), "Error - thread-safe mode needs the plain ring");
+	DIE(config->replicas > MAX_REPLICAS, "Error - too many replicas");
+	DIE(config->replicas > 1 && (config->engine != LB_ENGINE_RING ||
+		config->epsilon > 0 || config->thread_safe),
+		"Error - replicas need the plain ring without threads");
+	DIE(config->read_cache && config->thread_safe,
+		"Error - the read cache is not thread-safe");
+	DIE(config->read_cache && config->replicas > 1,
+		"Error - the read cache can't be used with replicas");
+
 	// Allocating the load balancer struct
-	load_balancer *main = malloc(sizeof(load_balancer));
+	load_balancer *main = calloc(1, sizeof(load_balancer));
 	DIE(main == NULL, "Error allocating load balancer");
+	main->stats = stats_create();
 
 	// Initialising its fields
 	main->elements = 0;
-	main->max_size = MAX_SIZE;
-
-	// Allocating the array for the hash ring
-	// (it stores pointers to server_info)
-	main->h_ring = malloc(main->max_size * sizeof(server_info*));
-	DIE(main->h_ring == NULL, "Error allocating hash ring");
-	for (unsigned int i = 0; i < main->max_size; i++)
-		main->h_ring[i] = NULL;
+	main->max_size = 0;
+	main->hashes = NULL;
+	main->server_ids = NULL;
+	main->servers = NULL;
+	ring_reserve(main, INITIAL_SIZE);
+
+	main->engine = config->engine;
+	main->hash = config->key_hash == LB_HASH_WY ? hash_wy : hash_djb2;
+	main->epsilon = config->epsilon;
+	main->replicas = config->replicas ? config->replicas : 1;
+	if (main->engine == LB_ENGINE_MAGLEV) {
+		main->maglev_size = config->maglev_size ?
+							config->maglev_size : MAGLEV_SIZE;
+		DIE(!is_prime(main->maglev_size), "Error - maglev size is not prime");
+		main->maglev = malloc(main->maglev_size * sizeof(unsigned int));
+		DIE(main->maglev == NULL, "Error allocating maglev table");
+	}
+
+	main->slab = slab_create(SLAB_HUGE_PAGES);
+	if (config->read_cache)
+		main->cache = cache_create(config->read_cache);
+	if (config->thread_safe) {
+		main->thread_safe = 1;
+		slab_enable_threads(main->slab);
+		DIE(pthread_mutex_init(&main->topology, NULL),
+			"Error creating topology lock");
+		main->readers = calloc(MAX_READERS, sizeof(reader_slot));
+		DIE(main->readers == NULL, "Error allocating readers");
+		main->epoch = 1;
+		main->view = view_create(main);
+	}
 	return main;
 }
 
+// Returns the first copy with a hash greater than the key hash, wrapping
+// to the first copy of the ring
+static unsigned int ring_upper_bound(lb_stats_set *stats,
+									const unsigned int *hashes,
+									unsigned int elements,
+									unsigned int hash_key) {
+	if (elements == 0)
+		return 0;
+	STATS_ADD(stats, LB_STAT_RING_SEARCHES, 1);
+	STATS_ADD(stats, LB_STAT_RING_STEPS, 32 - __builtin_clz(elements));
+
+	// Branchless binary search over the packed hashes: the loop always
+	// runs log2(elements) times and only moves the base of the window
+	const unsigned int *base = hashes;
+	unsigned int len = elements;
+	while (len > 1) {
+		unsigned int half = len / 2;
+		base += (base[half - 1] <= hash_key) ? half : 0;
+		len -= half;
+	}
+	unsigned int index = (base - hashes) + (*base <= hash_key);
+
+	// If I didn't find a server with a greater hash, than I have to
+	// add to the 1st server
+	if (index == elements)
+		index = 0;
+	return index;
+}
+
+static ring_view* view_create(load_balancer* main) {
+	unsigned int n = main->elements;
+	ring_view *view = malloc(sizeof(ring_view) + n * (sizeof(unsigned int)
+							+ sizeof(int) + sizeof(server_memory *)));
+	DIE(view == NULL, "Error allocating ring view");
+
+	// the three arrays follow the view in the same allocation
+	view->elements = n;
+	view->stats = main->stats;
+	view->servers = (server_memory **)(view + 1);
+	view->hashes = (unsigned int *)(view->servers + n);
+	view->server_ids = (int *)(view->hashes + n);
+	memcpy(view->servers, main->servers, n * sizeof(server_memory *));
+	memcpy(view->hashes, main->hashes, n * sizeof(unsigned int));
+	memcpy(view->server_ids, main->server_ids, n * sizeof(int));
+	return view;
+}
+
+// Frees the slot of a thread which exits (its epoch is 0 in every load
+// balancer, as it is outside all of them)
+static void reader_release(void *slot) {
+	__atomic_store_n(&reader_taken[(long)slot - 1], 0, __ATOMIC_RELEASE);
+}
+
+static void reader_key_create(void) {
+	DIE(pthread_key_create(&reader_key, reader_release),
+		"Error creating reader key");
+}
+
+static int reader_take(void) {
+	pthread_once(&reader_key_once, reader_key_create);
+	for (int i = 0; i < MAX_READERS; i++) {
+		char expected = 0;
+
+		if (__atomic_load_n(&reader_taken[i], __ATOMIC_RELAXED) ||
+			!__atomic_compare_exchange_n(&reader_taken[i], &expected, 1, 0,
+										__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			continue;
+		int used = __atomic_load_n(&readers_used, __ATOMIC_SEQ_CST);
+		while (used <= i &&
+			!__atomic_compare_exchange_n(&readers_used, &used, i + 1, 0,
+										__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			;
+		pthread_setspecific(reader_key, (void *)(long)(i + 1));
+		return i;
+	}
+	DIE(1, "Error - too many threads");
+	return -1;
+}
+
+// Marks the calling thread as reading: the views (and the servers they
+// point to) it loads stay valid until reader_exit()
+static void reader_enter(load_balancer* main) {
+	if (reader_id < 0)
+		reader_id = reader_take();
+	__atomic_store_n(&main->readers[reader_id].epoch,
+					__atomic_load_n(&main->epoch, __ATOMIC_SEQ_CST),
+					__ATOMIC_SEQ_CST);
+}
+
+static void reader_exit(load_balancer* main) {
+	__atomic_store_n(&main->readers[reader_id].epoch, 0, __ATOMIC_RELEASE);
+}
+
+// Waits until every reader which could still see an unlinked view has left
+static void wait_for_readers(load_balancer* main) {
+	unsigned long long epoch = __atomic_add_fetch(&main->epoch, 1,
+												__ATOMIC_SEQ_CST);
+	int used = __atomic_load_n(&readers_used, __ATOMIC_SEQ_CST);
+
+	for (int i = 0; i < used; i++) {
+		reader_slot *slot = &main->readers[i];
+		unsigned long long seen;
+
+		while ((seen = __atomic_load_n(&slot->epoch, __ATOMIC_SEQ_CST)) &&
+			seen < epoch)
+			sched_yield();
+	}
+}
+
+// Publishes the ring after one step of a change of the servers. The view
+// before it stays reachable as prev until the keys of the step moved
+static void step_publish(load_balancer* main) {
+	if (!main->thread_safe)
+		return;
+	ring_view *unlinked = main->prev;
+
+	__atomic_store_n(&main->prev, main->view, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&main->view, view_create(main), __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&main->moves, 1, __ATOMIC_SEQ_CST);
+	wait_for_readers(main);
+	free(unlinked);
+}
+
+static server_memory* view_owner(ring_view* view, unsigned int hash_key,
+								int* server_id) {
+	DIE(view->elements == 0, "Error - there are no servers");
+	unsigned int index = ring_upper_bound(view->stats, view->hashes,
+										view->elements, hash_key);
+
+	if (server_id)
+		*server_id = view->server_ids[index];
+	return view->servers[index];
+}
+
+// Locks two servers for writing, always in the same order
+static void lock_pair(server_memory* a, server_memory* b) {
+	if (b == NULL || a == b) {
+		pthread_rwlock_wrlock(&a->lock);
+		return;
+	}
+	if (a > b) {
+		server_memory *aux = a;
+
+		a = b;
+		b = aux;
+	}
+	pthread_rwlock_wrlock(&a->lock);
+	pthread_rwlock_wrlock(&b->lock);
+}
+
+static void unlock_pair(server_memory* a, server_memory* b) {
+	if (b != NULL && b != a)
+		pthread_rwlock_unlock(&b->lock);
+	pthread_rwlock_unlock(&a->lock);
+}
+
+// While keys move, a store goes to the owner on the new ring and drops
+// the copy the owner on the previous ring may still have. The views are
+// checked again under the locks, which the moves need too
+static void checkpoint_if_big(load_balancer* main);
+
+static void log_store(load_balancer* main, const char* key,
+					unsigned int key_len, const char* value,
+					unsigned int value_len) {
+	journal_record record = {JOURNAL_STORE, 0, 0, key, key_len, value,
+							value_len};
+
+	journal_append(main->journal, &record);
+}
+
+static void ts_store(load_balancer* main, const char* key,
+					unsigned int key_len, const char* value,
+					unsigned int value_len, int* server_id) {
+	unsigned int hash_key = main->hash(key, key_len);
+
+	while (1) {
+		reader_enter(main);
+		ring_view *view = __atomic_load_n(&main->view, __ATOMIC_SEQ_CST);
+		ring_view *prev = __atomic_load_n(&main->prev, __ATOMIC_SEQ_CST);
+		int id;
+		server_memory *server = view_owner(view, hash_key, &id);
+		server_memory *old = prev ? view_owner(prev, hash_key, NULL) : NULL;
+		if (old == server)
+			old = NULL;
+
+		lock_pair(server, old);
+		int current = __atomic_load_n(&main->view, __ATOMIC_SEQ_CST) == view
+					&& __atomic_load_n(&main->prev, __ATOMIC_SEQ_CST) == prev;
+		if (current) {
+			unsigned int before = server->size + (old ? old->size : 0);
+
+			if (old)
+				server_remove_n(old, key, key_len, hash_key);
+			server_store_n(server, key, key_len, value, value_len, hash_key);
+			__atomic_add_fetch(&main->keys, server->size + (old ? old->size : 0)
+							- before, __ATOMIC_RELAXED);
+			*server_id = id;
+			// under the lock, so the journal keeps the order of the stores
+			if (main->journal)
+				log_store(main, key, key_len, value, value_len);
+		}
+		unlock_pair(server, old);
+		reader_exit(main);
+		if (current)
+			return;
+	}
+}
+
+static char* view_find(ring_view* view, const char* key, unsigned int key_len,
+					unsigned int hash_key, int* server_id,
+					unsigned int* value_len, char* buffer,
+					unsigned int size) {
+	server_memory *server = view_owner(view, hash_key, server_id);
+
+	pthread_rwlock_rdlock(&server->lock);
+	char *value = server_retrieve_n(server, key, key_len, hash_key,
+									value_len);
+	if (value && buffer) {
+		snprintf(buffer, size, "%s", value);
+		value = buffer;
+	}
+	pthread_rwlock_unlock(&server->lock);
+	return value;
+}
+
+// A key which is not on its owner may still be on its owner on the
+// previous ring. A miss is only trusted if no keys moved meanwhile;
+// with a buffer the value is copied under the server lock
+static char* ts_retrieve(load_balancer* main, const char* key,
+						unsigned int key_len, int* server_id,
+						unsigned int* value_len, char* buffer,
+						unsigned int size) {
+	unsigned int hash_key = main->hash(key, key_len);
+
+	while (1) {
+		reader_enter(main);
+		unsigned long long moves = __atomic_load_n(&main->moves,
+												__ATOMIC_SEQ_CST);
+		ring_view *view = __atomic_load_n(&main->view, __ATOMIC_SEQ_CST);
+		char *value = view_find(view, key, key_len, hash_key, server_id,
+								value_len, buffer, size);
+
+		ring_view *prev = __atomic_load_n(&main->prev, __ATOMIC_SEQ_CST);
+		if (value == NULL && prev != NULL) {
+			int old_id;
+
+			value = view_find(prev, key, key_len, hash_key, &old_id,
+							value_len, buffer, size);
+			if (value)
+				*server_id = old_id;
+		}
+		int trusted = value || __atomic_load_n(&main->moves,
+											__ATOMIC_SEQ_CST) == moves;
+		reader_exit(main);
+		if (trusted)
+			return value;
+	}
+}
+
+// Locks the two servers keys move between
+static void lock_move(load_balancer* main, server_memory* dst,
+					server_memory* src) {
+	if (main->thread_safe)
+		lock_pair(dst, src);
+}
+
+// Unlocks them once the keys moved, telling the readers to check again
+static void unlock_move(load_balancer* main, server_memory* dst,
+						server_memory* src) {
+	if (!main->thread_safe)
+		return;
+	__atomic_add_fetch(&main->moves, 1, __ATOMIC_SEQ_CST);
+	unlock_pair(dst, src);
+}
+
+// Changes of the servers are serialised in thread-safe mode
+static void topology_begin(load_balancer* main) {
+	if (main->thread_safe)
+		pthread_mutex_lock(&main->topology);
+}
+
+// Drops the view before the current one once no reader can still use it
+static void retire_prev(load_balancer* main) {
+	if (!main->thread_safe)
+		return;
+	ring_view *unlinked = __atomic_exchange_n(&main->prev, NULL,
+											__ATOMIC_SEQ_CST);
+
+	wait_for_readers(main);
+	free(unlinked);
+}
+
+static void topology_end(load_balancer* main) {
+	if (!main->thread_safe)
+		return;
+	retire_prev(main);
+	pthread_mutex_unlock(&main->topology);
+}
+
+// Returns the server which owns a key hash, and its id
+static server_memory* route_key(load_balancer* main, unsigned int hash_key,
+								int* server_id) {
+	DIE(main->nmembers == 0, "Error - there are no servers");
+	unsigned int member;
+
+	switch (main->engine) {
+	case LB_ENGINE_MAGLEV:
+		member = main->maglev[hash_function_servers(&hash_key) %
+								main->maglev_size];
+		break;
+	case LB_ENGINE_JUMP:
+		member = jump_hash(hash_key * 0x9e3779b97f4a7c15ull, main->nmembers);
+		break;
+	default: {
+		int index = server_search(main, hash_key);
+
+		*server_id = main->server_ids[index];
+		return main->servers[index];
+	}
+	}
+	*server_id = main->member_ids[member];
+	return main->members[member];
+}
+
+static server_memory* owner_of(unsigned int hash_key, void *arg) {
+	int server_id;
+
+	return route_key((load_balancer *)arg, hash_key, &server_id);
+}
+
+// Fills set with the copies of the servers which store the keys of the
+// arc of a copy: the first copies of distinct servers from it on,
+// clockwise. Leaving out a copy (or every copy of a server) gives the
+// set the arc had before the copy was added (or has once the server is
+// gone). Returns the size of the set
+static unsigned int replica_set(load_balancer* main, unsigned int index,
+								unsigned int skip_copy,
+								const server_memory* skip_server,
+								unsigned int* set) {
+	unsigned int count = 0, n = main->elements;
+
+	for (unsigned int step = 0; step < n && count < main->replicas; step++) {
+		unsigned int i = (index + step) % n;
+		server_memory *server = main->servers[i];
+		unsigned int k = 0;
+
+		if (i == skip_copy || server == skip_server)
+			continue;
+		while (k < count && main->servers[set[k]] != server)
+			k++;
+		if (k == count)
+			set[count++] = i;
+	}
+	return count;
+}
+
+// 1 if two replica sets have the same servers in the same order
+static int same_replicas(load_balancer* main, const unsigned int* a,
+						unsigned int na, const unsigned int* b,
+						unsigned int nb) {
+	if (na != nb)
+		return 0;
+	for (unsigned int k = 0; k < na; k++)
+		if (main->servers[a[k]] != main->servers[b[k]])
+			return 0;
+	return 1;
+}
+
+// Reads a key from its replica which served the fewest reads, so the
+// reads of a hot key are spread over all the servers which store it
+static char* replica_retrieve(load_balancer* main, const char* key,
+							unsigned int key_len, unsigned int hash_key,
+							int* server_id, unsigned int* value_len) {
+	DIE(main->nmembers == 0, "Error - there are no servers");
+	unsigned int set[MAX_REPLICAS];
+	unsigned int count = replica_set(main, server_search(main, hash_key),
+									main->elements, NULL, set);
+	unsigned int best = set[0];
+
+	for (unsigned int k = 1; k < count; k++)
+		if (main->servers[set[k]]->reads < main->servers[best]->reads)
+			best = set[k];
+	server_memory *server = main->servers[best];
+	server->reads++;
+	*server_id = main->server_ids[best];
+	return server_retrieve_n(server, key, key_len, hash_key, value_len);
+}
+
+// Maximum number of keys a server may hold with bounded loads
+static unsigned int load_cap(load_balancer* main, unsigned long long keys) {
+	double cap = (1 + main->epsilon) * keys / main->nmembers;
+	if (cap >= UINT_MAX)
+		return UINT_MAX;
+	unsigned int whole = (unsigned int)cap;
+
+	return whole < cap ? whole + 1 : whole;
+}
+
+// Returns the first copy after a hash whose server is under the load cap.
+// The servers can't all be full, since their caps add up to at least keys
+static unsigned int bounded_place(load_balancer* main, unsigned int hash_key,
+								unsigned long long keys) {
+	unsigned int cap = load_cap(main, keys);
+	unsigned int index = server_search(main, hash_key);
+
+	for (unsigned int spill = 0; ; spill++) {
+		if (main->servers[index]->size < cap) {
+			if (spill > main->max_spill)
+				main->max_spill = spill;
+			return index;
+		}
+		index = (index + 1) % main->elements;
+	}
+}
+
+// Returns the copy whose server stores a key or -1. A stored key never
+// spilled further than max_spill copies, so only those are checked
+static int bounded_find(load_balancer* main, unsigned int hash_key,
+						const char* key, unsigned int key_len, char** value,
+						unsigned int* value_len) {
+	unsigned int index = server_search(main, hash_key);
+
+	for (unsigned int spill = 0; spill <= main->max_spill; spill++) {
+		*value = server_retrieve_n(main->servers[index], key, key_len,
+								hash_key, value_len);
+		if (*value)
+			return index;
+		index = (index + 1) % main->elements;
+	}
+	return -1;
+}
+
+static server_memory* bounded_owner(unsigned int hash_key, void *arg) {
+	load_balancer *main = arg;
+
+	return main->servers[bounded_place(main, hash_key, main->keys)];
+}
+
+static server_memory* to_staging(unsigned int hash_key, void *arg) {
+	(void)hash_key;
+	return arg;
+}
+
+// Places again every key with bounded loads after the servers changed:
+// all of them are gathered on a staging server (together with the ones
+// of a removed server) and handed out from there
+static void bounded_rehome(load_balancer* main, server_memory* removed) {
+	server_memory *staging = init_server_memory_shared(main->slab);
+	server_set_hash(staging, main->hash);
+
+	for (unsigned int i = 0; i < main->nmembers; i++)
+		server_move_if(main->members[i], to_staging, staging);
+	if (removed)
+		server_move_if(removed, to_staging, staging);
+
+	main->max_spill = 0;
+	if (main->nmembers > 0)
+		main->moved += server_move_if(staging, bounded_owner, main);
+	else
+		main->keys = 0;  // the last server took its keys with it
+	free_server_memory(staging);
+}
+
 void loader_store(load_balancer* main, char* key, char* value, int* server_id) {
-	DIE(main == NULL, "Error - no load balancer in store");
+	loader_store_n(main, key, strlen(key), value, strlen(value), server_id);
+}
+
+static void store_n(load_balancer* main, const char* key, unsigned int key_len,
+					const char* value, unsigned int value_len,
+					int* server_id) {
+	if (main->thread_safe) {
+		ts_store(main, key, key_len, value, value_len, server_id);
+		return;
+	}
 
-	// Getting the index where I have to add the object
-	unsigned int hash_key = hash_function_key(key);
-	int index = server_search(main, hash_key);
+	// Getting the server where I have to add the object
+	unsigned int hash_key = main->hash(key, key_len);
+	server_memory *server;
+	if (main->cache)
+		cache_invalidate(main->cache, key, key_len, hash_key);
+	if (main->replicas > 1) {
+		// every replica gets the object, the first one is reported
+		DIE(main->nmembers == 0, "Error - there are no servers");
+		unsigned int set[MAX_REPLICAS];
+		unsigned int count = replica_set(main, server_search(main, hash_key),
+										main->elements, NULL, set);
+
+		for (unsigned int k = 0; k < count; k++) {
+			server = main->servers[set[k]];
+			unsigned int before = server->size;
+			server_store_n(server, key, key_len, value, value_len, hash_key);
+			main->keys += server->size - before;
+		}
+		*server_id = main->server_ids[set[0]];
+		if (main->journal)
+			log_store(main, key, key_len, value, value_len);
+		return;
+	}
+	if (main->epsilon > 0) {
+		DIE(main->nmembers == 0, "Error - there are no servers");
+		char *old;
+		int index = bounded_find(main, hash_key, key, key_len, &old, NULL);
+
+		if (index < 0)
+			index = bounded_place(main, hash_key, main->keys + 1);
+		*server_id = main->server_ids[index];
+		server = main->servers[index];
+	} else {
+		server = route_key(main, hash_key, server_id);
+	}
 
-	*server_id = main->h_ring[index]->server_id;
 	// Storing the object
-	server_store(main->h_ring[index]->server, key, value);
+	unsigned int before = server->size;
+	server_store_n(server, key, key_len, value, value_len, hash_key);
+	main->keys += server->size - before;
+	if (main->journal)
+		log_store(main, key, key_len, value, value_len);
+}
+
+void loader_store_n(load_balancer* main, const char* key, unsigned int key_len,
+					const char* value, unsigned int value_len,
+					int* server_id) {
+	DIE(main == NULL, "Error - no load balancer in store");
+	STATS_BEGIN();
+	store_n(main, key, key_len, value, value_len, server_id);
+	STATS_ADD(main->stats, LB_STAT_STORES, 1);
+	STATS_END(main->stats, LB_OP_STORE);
+	if (main->compact_bytes)
+		checkpoint_if_big(main);
 }
 
 char* loader_retrieve(load_balancer* main, char* key, int* server_id) {
-	DIE(main == NULL, "Error - no load balancer");
+	return loader_retrieve_n(main, key, strlen(key), server_id, NULL);
+}
 
-	// Getting the index where I should find the key
-	unsigned int hash_key = hash_function_key(key);
-	int index = server_search(main, hash_key);
-	*server_id = ((server_info *)(main->h_ring[index]))->server_id;
+// Looks a key up on the server which stores it
+static char* find_n(load_balancer* main, const char* key,
+					unsigned int key_len, unsigned int hash_key,
+					int* server_id, unsigned int* value_len) {
+	if (main->replicas > 1)
+		return replica_retrieve(main, key, key_len, hash_key, server_id,
+								value_len);
+	if (main->epsilon > 0) {
+		DIE(main->nmembers == 0, "Error - there are no servers");
+		char *value;
+		int index = bounded_find(main, hash_key, key, key_len, &value,
+								value_len);
+
+		// a missing key is reported on the server which owns its hash
+		if (index < 0)
+			index = server_search(main, hash_key);
+		*server_id = main->server_ids[index];
+		main->servers[index]->reads++;
+		return value;
+	}
+	server_memory *server = route_key(main, hash_key, server_id);
+	server->reads++;
 
 	// Checking if the key exists
-	return server_retrieve(((server_info *)(main->h_ring[index]))->server, key);
+	return server_retrieve_n(server, key, key_len, hash_key, value_len);
 }
 
-void loader_add_server(load_balancer* main, int server_id) {
-	DIE(main == NULL, "Error - no load balancer in add_server");
+static char* retrieve_n(load_balancer* main, const char* key,
+						unsigned int key_len, int* server_id,
+						unsigned int* value_len) {
+	if (main->thread_safe)
+		return ts_retrieve(main, key, key_len, server_id, value_len, NULL, 0);
 
-	// Initialising the server
-	server_memory *server = init_server_memory();
-
-	server_info *info_0 = create_h_ring_entry(main, 0, server_id, server);
-	server_info *info_1 = create_h_ring_entry(main, 1, server_id, server);
-	server_info *info_2 = create_h_ring_entry(main, 2, server_id, server);
-
-	// Adding to the hash ring and returning the server from which we
-	// have to share objects
-	server_info *server_neigh_0 = src_add_server(main, info_0);
-	server_info *behind_0 = get_sv_behind(main, info_0->tag_server);
-	add_redistribute(main, info_0, server_neigh_0, behind_0);
-	server_info *server_neigh_1 = src_add_server(main, info_1);
-	server_info *behind_1 = get_sv_behind(main, info_1->tag_server);
-	add_redistribute(main, info_1, server_neigh_1, behind_1);
-	server_info *server_neigh_2 = src_add_server(main, info_2);
-	server_info *behind_2 = get_sv_behind(main, info_2->tag_server);
-	add_redistribute(main, info_2, server_neigh_2, behind_2);
-}
-
-void loader_remove_server(load_balancer* main, int server_id) {
+	// Getting the server where I should find the key
+	unsigned int hash_key = main->hash(key, key_len);
+	if (main->cache == NULL)
+		return find_n(main, key, key_len, hash_key, server_id, value_len);
+
+	// a hot key skips the ring and the table of its server
+	char *value = cache_find(main->cache, key, key_len, hash_key, server_id,
+							value_len);
+	if (value == NULL) {
+		value = find_n(main, key, key_len, hash_key, server_id, value_len);
+		if (value)
+			cache_insert(main->cache, key, key_len, hash_key, value,
+						*value_len, *server_id);
+	}
+	return value;
+}
+
+char* loader_retrieve_n(load_balancer* main, const char* key,
+						unsigned int key_len, int* server_id,
+						unsigned int* value_len) {
 	DIE(main == NULL, "Error - no load balancer");
+	unsigned int length;
+	STATS_BEGIN();
+	char *value = retrieve_n(main, key, key_len, server_id,
+							value_len ? value_len : &length);
+	STATS_ADD(main->stats, LB_STAT_RETRIEVES, 1);
+	STATS_ADD(main->stats, LB_STAT_HITS, value != NULL);
+	STATS_END(main->stats, LB_OP_RETRIEVE);
+	return value;
+}
+
+char* loader_retrieve_copy(load_balancer* main, char* key, char* buffer,
+						unsigned int size, int* server_id) {
+	DIE(main == NULL, "Error - no load balancer");
+	DIE(buffer == NULL || size == 0, "Error - no buffer for the value");
+	if (main->thread_safe) {
+		STATS_BEGIN();
+		char *value = ts_retrieve(main, key, strlen(key), server_id, NULL,
+								buffer, size);
+		STATS_ADD(main->stats, LB_STAT_RETRIEVES, 1);
+		STATS_ADD(main->stats, LB_STAT_HITS, value != NULL);
+		STATS_END(main->stats, LB_OP_RETRIEVE);
+		return value;
+	}
+
+	char *value = loader_retrieve(main, key, server_id);
+	if (value == NULL)
+		return NULL;
+	snprintf(buffer, size, "%s", value);
+	return buffer;
+}
+
+// A key of a batch, with the server it was routed to
+typedef struct batch_key {
+	unsigned int hash;
+	unsigned int poz;  // position of the key in the caller's arrays
+	int server_id;
+	server_memory *server;
+} batch_key;
+
+// How many keys ahead the server slots are prefetched
+#define PREFETCH_DISTANCE 8
+
+static int compare_batch_keys(const void *a, const void *b) {
+	const batch_key *x = a, *y = b;
+
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	return x->poz < y->poz ? -1 : x->poz > y->poz;
+}
+
+// Returns the first copy at or after index whose hash is greater than the
+// key hash, or elements if there is none (the key wraps to copy 0)
+static unsigned int ring_advance(load_balancer* main, unsigned int index,
+								unsigned int hash_key) {
+	// the next key of a sorted batch is usually in the same or a close arc
+	for (int step = 0; step < 4; step++) {
+		if (index == main->elements || main->hashes[index] > hash_key)
+			return index;
+		index++;
+	}
 
-	server_memory *server_out;
-	// The server id where an item will be redistributed
-	int sv_red_id;
+	unsigned int low = index, high = main->elements;
+	while (low < high) {
+		unsigned int mid = low + (high - low) / 2;
 
-	// Remove all the 3 copies of a server
-	for (int i = 0; i < 3; i++) {
-		server_out = server_remover(main, server_id);
+		if (main->hashes[mid] <= hash_key)
+			low = mid + 1;
+		else
+			high = mid;
 	}
+	return low;
+}
 
-	// Redistribute the items of a server
-	for (unsigned int j = 0; j < server_out->hmax; j++) {
-		ll_node_t *curr = server_out->buckets[j]->head;
+// Hashes the keys of a batch and sorts them by hash, so they are routed
+// with a single walk of the ring. Equal keys keep their order
+static batch_key* batch_route(load_balancer* main, char** keys,
+							unsigned int count) {
+	DIE(main->nmembers == 0, "Error - there are no servers");
+	batch_key *batch = malloc(count * sizeof(batch_key));
+	DIE(batch == NULL, "Error allocating batch");
 
-		while(curr != NULL) {
-			// Get the key-value pair
-			char *key = ((info_obj *)(curr->data))->key;
-			char *value = server_retrieve(server_out, key);
+	for (unsigned int i = 0; i < count; i++) {
+		batch[i].hash = main->hash(keys[i], strlen(keys[i]));
+		batch[i].poz = i;
+	}
+	qsort(batch, count, sizeof(batch_key), compare_batch_keys);
 
-			loader_store(main, key, value, &sv_red_id);
-			curr = curr->next;
+	unsigned int index = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		if (main->engine != LB_ENGINE_RING) {
+			batch[i].server = route_key(main, batch[i].hash,
+										&batch[i].server_id);
+			continue;
 		}
+		index = ring_advance(main, index, batch[i].hash);
+		unsigned int owner = index == main->elements ? 0 : index;
+		batch[i].server_id = main->server_ids[owner];
+		batch[i].server = main->servers[owner];
 	}
-	// Free the server
-	free_server_memory(server_out);
+	return batch;
 }
 
-void free_load_balancer(load_balancer* main) {
+void loader_store_batch(load_balancer* main, char** keys, char** values,
+						unsigned int count, int* server_ids) {
+	DIE(main == NULL, "Error - no load balancer in store");
+
+	// With bounded loads the placement depends on the order of the stores
+	if (main->epsilon > 0 || main->thread_safe || main->replicas > 1) {
+		for (unsigned int i = 0; i < count; i++)
+			loader_store(main, keys[i], values[i], &server_ids[i]);
+		return;
+	}
+
+	batch_key *batch = batch_route(main, keys, count);
+	for (unsigned int i = 0; i < count; i++) {
+		if (i + PREFETCH_DISTANCE < count)
+			server_prefetch(batch[i + PREFETCH_DISTANCE].server,
+							batch[i + PREFETCH_DISTANCE].hash);
+
+		server_memory *server = batch[i].server;
+		unsigned int poz = batch[i].poz, before = server->size;
+		if (main->cache)
+			cache_invalidate(main->cache, keys[poz], strlen(keys[poz]),
+							batch[i].hash);
+		server_store_n(server, keys[poz], strlen(keys[poz]), values[poz],
+					strlen(values[poz]), batch[i].hash);
+		main->keys += server->size - before;
+		server_ids[poz] = batch[i].server_id;
+	}
+	STATS_ADD(main->stats, LB_STAT_STORES, count);
+	free(batch);
+
+	// the journal gets the stores in the caller's order
+	if (main->journal) {
+		for (unsigned int i = 0; i < count; i++)
+			log_store(main, keys[i], strlen(keys[i]), values[i],
+					strlen(values[i]));
+		if (main->compact_bytes)
+			checkpoint_if_big(main);
+	}
+}
+
+void loader_retrieve_batch(load_balancer* main, char** keys,
+						unsigned int count, int* server_ids, char** values) {
 	DIE(main == NULL, "Error - no load balancer");
-	while (main->elements > 0) {
-		int server_id = ((server_info *)(main->h_ring[0]))->server_id;
-		server_memory *server_out;
 
-		// Remove all the 3 copies of a server
-		for (int i = 0; i < 3; i++) {
-			server_out = server_remover(main, server_id);
-		}
-		free_server_memory(server_out);
+	if (main->epsilon > 0 || main->thread_safe || main->replicas > 1) {
+		for (unsigned int i = 0; i < count; i++)
+			values[i] = loader_retrieve(main, keys[i], &server_ids[i]);
+		return;
 	}
-	free(main->h_ring);
-	free(main);
+
+	batch_key *batch = batch_route(main, keys, count);
+	for (unsigned int i = 0; i < count; i++) {
+		if (i + PREFETCH_DISTANCE < count)
+			server_prefetch(batch[i + PREFETCH_DISTANCE].server,
+							batch[i + PREFETCH_DISTANCE].hash);
+
+		unsigned int poz = batch[i].poz;
+		values[poz] = server_retrieve_n(batch[i].server, keys[poz],
+										strlen(keys[poz]), batch[i].hash,
+										NULL);
+		batch[i].server->reads++;
+		server_ids[poz] = batch[i].server_id;
+		STATS_ADD(main->stats, LB_STAT_HITS, values[poz] != NULL);
+	}
+	STATS_ADD(main->stats, LB_STAT_RETRIEVES, count);
+	free(batch);
 }
 
-// Extra functions
+void loader_route_n(load_balancer* main, const char* key,
+					unsigned int key_len, lb_route* route) {
+	DIE(main == NULL, "Error - no load balancer");
+	DIE(main->epsilon > 0 || main->replicas > 1 || main->cache,
+		"Error - only keys with a single owner can be routed");
+	route->hash = main->hash(key, key_len);
+	route->server = route_key(main, route->hash, &route->server_id);
+}
 
-// Returns the index where an item should be item
-int server_search(load_balancer *main, unsigned int hash_key) {
+// In thread-safe mode the server is locked, since a checkpoint or the
+// stats may read it from another thread
+void loader_store_routed(load_balancer* main, const lb_route* route,
+						const char* key, unsigned int key_len,
+						const char* value, unsigned int value_len) {
+	DIE(main == NULL || route == NULL, "Error - no load balancer in store");
+	server_memory *server = route->server;
+	STATS_BEGIN();
+
+	if (main->thread_safe)
+		pthread_rwlock_wrlock(&server->lock);
+	unsigned int before = server->size;
+	server_store_n(server, key, key_len, value, value_len, route->hash);
+	__atomic_add_fetch(&main->keys, server->size - before, __ATOMIC_RELAXED);
+	if (main->journal)
+		log_store(main, key, key_len, value, value_len);
+	if (main->thread_safe)
+		pthread_rwlock_unlock(&server->lock);
+	STATS_ADD(main->stats, LB_STAT_STORES, 1);
+	STATS_END(main->stats, LB_OP_STORE);
+	if (main->compact_bytes)
+		checkpoint_if_big(main);
+}
+
+char* loader_retrieve_routed(load_balancer* main, const lb_route* route,
+							const char* key, unsigned int key_len,
+							unsigned int* value_len) {
+	DIE(main == NULL || route == NULL, "Error - no load balancer");
+	server_memory *server = route->server;
+	STATS_BEGIN();
+
+	if (main->thread_safe)
+		pthread_rwlock_rdlock(&server->lock);
+	char *value = server_retrieve_n(server, key, key_len, route->hash,
+									value_len);
+	if (main->thread_safe)
+		pthread_rwlock_unlock(&server->lock);
+	else
+		server->reads++;
+	STATS_ADD(main->stats, LB_STAT_RETRIEVES, 1);
+	STATS_ADD(main->stats, LB_STAT_HITS, value != NULL);
+	STATS_END(main->stats, LB_OP_RETRIEVE);
+	return value;
+}
+
+int loader_add_server(load_balancer* main, int server_id) {
+	return loader_add_server_weighted(main, server_id, DEFAULT_REPLICAS);
+}
+
+static void replica_add(load_balancer* main, unsigned int index);
+
+// Called with the topology lock held
+static void add_server(load_balancer* main, int server_id, int vnodes) {
+	// Initialising the server
+	server_memory *server = init_server_memory_shared(main->slab);
+	server_set_hash(server, main->hash);
+	// it starts with the fewest reads of the others, or the replicas
+	// would send it all their reads until it caught up
+	for (unsigned int i = 0; i < main->nmembers; i++)
+		if (i == 0 || main->members[i]->reads < server->reads)
+			server->reads = main->members[i]->reads;
+	member_insert(main, server_id, server, vnodes);
+
+	if (main->engine != LB_ENGINE_RING) {
+		// The other engines move every key whose owner changed
+		rebuild_routing(main);
+		main->moved += rehome_all(main);
+		return;
+	}
+
+	ring_reserve(main, main->elements + vnodes);
+	for (int i = 0; i < vnodes; i++) {
+		// Adding to the hash ring and taking from the next server
+		// the objects which belong to the new copy
+		unsigned int index = src_add_server(main, i, server_id, server);
+		server_memory *next = main->servers[(index + 1) % main->elements];
+
+		step_publish(main);
+		if (main->replicas > 1) {
+			replica_add(main, index);
+		} else if (main->epsilon == 0) {
+			// only the keys it takes from the next copy are counted, not
+			// the ones stored on it since the copy was published
+			lock_move(main, server, next);
+			unsigned int had = server->size;
+			add_redistribute(main, index);
+			main->moved += server->size - had;
+			unlock_move(main, server, next);
+		}
+	}
+
+	// The caps changed, so with bounded loads every key is placed again
+	if (main->epsilon > 0)
+		bounded_rehome(main, NULL);
+}
+
+int loader_add_server_weighted(load_balancer* main, int server_id,
+								int vnodes) {
 	DIE(main == NULL, "Error - no load balancer in add_server");
-	unsigned int index = 0, ok = 1;
+	DIE(vnodes <= 0, "Error - a server needs at least one copy");
+	// the members are only changed (and looked up) under the topology lock,
+	// which also keeps a checkpoint from seeing half a change
+	topology_begin(main);
+	if (member_find(main, server_id) >= 0) {
+		topology_end(main);
+		return -1;
+	}
+	STATS_BEGIN();
+	add_server(main, server_id, vnodes);
+	STATS_END(main->stats, LB_OP_ADD_SERVER);
+	topology_end(main);
+	// the cached values of the keys which moved are gone
+	if (main->cache)
+		cache_clear(main->cache);
+	if (main->journal) {
+		journal_record record = {JOURNAL_ADD_SERVER, server_id, vnodes,
+								NULL, 0, NULL, 0};
 
-	// Searching for the desired server in the ring
-	while (index < main->elements && ok) {
-		if (hash_key < main->h_ring[index]->hash) {
-			ok = 0;
+		journal_wait(main->journal, journal_append(main->journal, &record));
+	}
+	return 0;
+}
+
+// Moves the objects of the arc [from, to) of the ring to another server
+static void move_arc(server_memory *dst, server_memory *src,
+					unsigned int from, unsigned int to, int wraps) {
+	if (wraps) {
+		// the arc goes over the end of the ring
+		server_move_range(dst, src, from, 0xffffffffu);
+		if (to > 0)
+			server_move_range(dst, src, 0, to - 1);
+	} else if (from < to) {
+		server_move_range(dst, src, from, to - 1);
+	}
+}
+
+// Visits the objects a server stores in the arc [from, to) of the ring
+static void visit_arc(server_memory *server, unsigned int from,
+					unsigned int to, int wraps,
+					void (*visit)(info_obj*, void*), void *arg) {
+	if (wraps) {
+		server_for_range(server, from, 0xffffffffu, visit, arg);
+		if (to > 0)
+			server_for_range(server, 0, to - 1, visit, arg);
+	} else if (from < to) {
+		server_for_range(server, from, to - 1, visit, arg);
+	}
+}
+
+static void copy_entry(info_obj *obj, void *arg) {
+	server_store_n(arg, info_key(obj), obj->key_len, info_value(obj),
+				obj->value_len, obj->hash);
+}
+
+static void drop_entry(info_obj *obj, void *arg) {
+	server_remove_n(arg, info_key(obj), obj->key_len, obj->hash);
+}
+
+// Hands the keys of the arc of copy j from its old replicas to the new
+// ones. A server which left the set gives its objects to one which
+// joined it, the other joining servers copy them from a server which
+// stays and the other leaving ones drop them (but a removed server
+// keeps them, it is freed anyway)
+static void replica_update(load_balancer* main, unsigned int j,
+						const unsigned int* old, unsigned int nold,
+						const unsigned int* now, unsigned int nnow,
+						const server_memory* removed) {
+	server_memory *joined[MAX_REPLICAS], *left[MAX_REPLICAS], *kept = NULL;
+	unsigned int njoined = 0, nleft = 0;
+	long long before = 0, after = 0;
+
+	for (unsigned int k = 0; k < nnow; k++) {
+		unsigned int i = 0;
+
+		while (i < nold && main->servers[old[i]] != main->servers[now[k]])
+			i++;
+		if (i == nold)
+			joined[njoined++] = main->servers[now[k]];
+		else
+			kept = main->servers[now[k]];
+	}
+	for (unsigned int k = 0; k < nold; k++) {
+		unsigned int i = 0;
+
+		while (i < nnow && main->servers[now[i]] != main->servers[old[k]])
+			i++;
+		if (i == nnow)
+			left[nleft++] = main->servers[old[k]];
+	}
+
+	unsigned int n = main->elements;
+	unsigned int from = main->hashes[(j + n - 1) % n], to = main->hashes[j];
+	for (unsigned int k = 0; k < nold; k++)
+		before += main->servers[old[k]]->size;
+	for (unsigned int k = 0; k < njoined; k++) {
+		unsigned int had = joined[k]->size;
+
+		before += had;
+		if (k < nleft)
+			move_arc(joined[k], left[k], from, to, j == 0);
+		else if (kept)
+			visit_arc(kept, from, to, j == 0, copy_entry, joined[k]);
+		main->moved += joined[k]->size - had;
+	}
+	for (unsigned int k = njoined; k < nleft; k++)
+		if (left[k] != removed)
+			visit_arc(left[k], from, to, j == 0, drop_entry, left[k]);
+
+	// the copies of every key, the removed server's included
+	for (unsigned int k = 0; k < nold; k++)
+		after += main->servers[old[k]]->size;
+	for (unsigned int k = 0; k < njoined; k++)
+		after += joined[k]->size;
+	main->keys += after - before;
+}
+
+// Updates the replicas of the arcs a new copy changed: its own arc and
+// the arcs before it whose sets reach it. Going back, the first arc
+// whose set didn't change ends the walk, since the arcs before it reach
+// the same servers first
+static void replica_add(load_balancer* main, unsigned int index) {
+	unsigned int old[MAX_REPLICAS], now[MAX_REPLICAS], n = main->elements;
+
+	for (unsigned int step = 0; step < n; step++) {
+		unsigned int j = (index + n - step) % n;
+		unsigned int nold = replica_set(main, j, index, NULL, old);
+		unsigned int nnow = replica_set(main, j, n, NULL, now);
+
+		if (same_replicas(main, old, nold, now, nnow))
 			break;
+		replica_update(main, j, old, nold, now, nnow, NULL);
+	}
+}
+
+// Gives a new replica to every arc whose set had a server which is
+// removed (its copies are still on the ring)
+static void replica_remove(load_balancer* main, server_memory* removed) {
+	unsigned int old[MAX_REPLICAS], now[MAX_REPLICAS], n = main->elements;
+
+	for (unsigned int j = 0; j < n; j++) {
+		unsigned int nold = replica_set(main, j, n, NULL, old);
+		unsigned int nnow = replica_set(main, j, n, removed, now);
+
+		if (!same_replicas(main, old, nold, now, nnow))
+			replica_update(main, j, old, nold, now, nnow, removed);
+	}
+}
+
+// Called with the topology lock held
+static void remove_server(load_balancer* main, int member) {
+	int server_id = main->member_ids[member];
+	server_memory *server_out = main->members[member];
+	member_erase(main, member);
+
+	if (main->engine != LB_ENGINE_RING) {
+		if (main->nmembers > 0) {
+			rebuild_routing(main);
+			main->moved += server_move_if(server_out, owner_of, main);
+			main->moved += rehome_all(main);
 		}
-		index++;
+		main->keys -= server_out->size;
+		free_server_memory(server_out);
+		return;
 	}
-	// If I didn't find a server with a greater hash, than I have to
-	// add to the 1st server
-	if (ok == 1)
-		index = 0;
-	return index;
+
+	if (main->epsilon > 0) {
+		server_remover(main, server_id);
+		bounded_rehome(main, server_out);
+		free_server_memory(server_out);
+		return;
+	}
+
+	if (main->replicas > 1) {
+		// the other replicas of its keys stay, every arc it was a
+		// replica of gets a new one
+		replica_remove(main, server_out);
+		main->keys -= server_out->size;
+		server_remover(main, server_id);
+		free_server_memory(server_out);
+		return;
+	}
+
+	ring_view ring = {main->elements, main->hashes, main->server_ids,
+					main->servers, main->stats};
+	if (main->thread_safe) {
+		// the readers switch to the ring without the server first and
+		// look for the keys which didn't move yet on the old one
+		ring = *main->view;
+		server_remover(main, server_id);
+		step_publish(main);
+	}
+
+	unsigned int n = ring.elements;
+	for (unsigned int i = 0; i < n; i++) {
+		if (ring.server_ids[i] != server_id)
+			continue;
+
+		// The objects of this copy can only go to the first copy after it
+		// which belongs to another server, so the whole arc is handed over
+		unsigned int next = (i + 1) % n;
+		while (next != i && ring.server_ids[next] == server_id)
+			next = (next + 1) % n;
+		if (next == i)
+			break;  // there is no other server left
+
+		unsigned int before = ring.hashes[i == 0 ? n - 1 : i - 1];
+		lock_move(main, ring.servers[next], server_out);
+		unsigned int had = server_out->size;
+		move_arc(ring.servers[next], server_out,
+				before, ring.hashes[i], i == 0);
+		main->moved += had - server_out->size;
+		unlock_move(main, ring.servers[next], server_out);
+	}
+
+	// Remove all the copies of a server and free it, once no reader
+	// can still reach it through an older view
+	__atomic_sub_fetch(&main->keys, server_out->size, __ATOMIC_RELAXED);
+	if (!main->thread_safe)
+		server_remover(main, server_id);
+	retire_prev(main);
+	free_server_memory(server_out);
 }
 
-// Function that initializes the information about a copy
-server_info* create_h_ring_entry(load_balancer *main, int tag_nr,
-							int server_id, server_memory *server) {
+int loader_remove_server(load_balancer* main, int server_id) {
 	DIE(main == NULL, "Error - no load balancer");
 
-	// Allocate structure for the server info structure
-	server_info *info = malloc(sizeof(server_info));
-	DIE(info == NULL, "Error allocating server_info");
+	topology_begin(main);
+	int member = member_find(main, server_id);
+	if (member < 0) {
+		topology_end(main);
+		return -1;
+	}
+	STATS_BEGIN();
+	remove_server(main, member);
+	STATS_END(main->stats, LB_OP_REMOVE_SERVER);
+	topology_end(main);
+	if (main->cache)
+		cache_clear(main->cache);
+	if (main->journal) {
+		journal_record record = {JOURNAL_REMOVE_SERVER, server_id, 0,
+								NULL, 0, NULL, 0};
 
-	// Initialising its fields
-	info->server_id = server_id;
-	info->tag_server = tag_nr * 1e5 + server_id;
-	info->server = server;
-	info->hash = hash_function_servers(&info->tag_server);
-	return info;
+		journal_wait(main->journal, journal_append(main->journal, &record));
+	}
+	return 0;
 }
 
-// Function that adds a new (copy of the) server to the hashring
-server_info* src_add_server(load_balancer* main, server_info* info) {
-	DIE(main == NULL, "Error - no load balancer");
-	DIE(info == NULL, "Error - no load balancer");
-	unsigned int index = 0, ok = 1;
-	// Start looking for the optimum position of a server in the hash ring
-	while (ok && index <= main->elements) {
-		if (main->h_ring[index] != NULL) {
-			// If this is not the good position keep looking
-			if (main->h_ring[index]->hash < info->hash) {
-				index++;
-			} else {
-				// If I found the good position I add it
-				if (main->h_ring[index]->hash > info->hash) {
-					shift_right(main, index);
-					main->h_ring[index] = info;
-					ok = 0;
-				} else {
-					// If the hashes are identical
-					if (info->server_id < main->h_ring[index]->server_id) {
-						shift_right(main, index);
-						main->h_ring[index] = info;
-						ok = 0;
-					} else {
-						if (info->server_id >
-							main->h_ring[index]->server_id &&
-							info->hash ==
-							main->h_ring[index + 1]->hash) {
-							index++;
-						} else {
-							shift_right(main, index);
-							index++;
-							main->h_ring[index] = info;
-							ok = 0;
-						}
-					}
-				}
-				main->elements++;
-			}
-		} else {
-			main->h_ring[index] = info;
-			main->elements++;
-			ok = 0;
+int loader_snapshot(load_balancer* main, const char* path) {
+	DIE(main == NULL || path == NULL, "Error - no load balancer");
+	// The snapshot replaces the file only once it was fully written
+	char *tmp = malloc(strlen(path) + sizeof(".tmp"));
+	DIE(tmp == NULL, "Error allocating snapshot path");
+	sprintf(tmp, "%s.tmp", path);
+	FILE *out = fopen(tmp, "wb");
+	if (out == NULL) {
+		free(tmp);
+		return -1;
+	}
+
+	if (main->thread_safe)
+		pthread_mutex_lock(&main->topology);
+	unsigned int n = main->nmembers;
+	snapshot_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byte_order = SNAPSHOT_BYTE_ORDER;
+	header.engine = main->engine;
+	header.key_hash = main->hash == hash_wy ? LB_HASH_WY : LB_HASH_DJB2;
+	header.maglev_size = main->maglev_size;
+	header.max_spill = main->max_spill;
+	header.epsilon = main->epsilon;
+	header.nmembers = n;
+	header.replicas = main->replicas;
+	header.ncopies = main->elements;
+	snapshot_member *members = calloc(n ? n : 1, sizeof(snapshot_member));
+	DIE(members == NULL, "Error allocating snapshot members");
+
+	// The members are written again at the end, with their entries
+	int error = fwrite(&header, sizeof(header), 1, out) != 1 ||
+				fwrite(members, sizeof(snapshot_member), n, out) != n;
+	for (unsigned int i = 0; i < main->elements && !error; i++) {
+		snapshot_copy copy = {main->hashes[i], main->server_ids[i]};
+
+		error = fwrite(&copy, sizeof(copy), 1, out) != 1;
+	}
+
+	for (unsigned int i = 0; i < n && !error; i++) {
+		server_memory *server = main->members[i];
+
+		// in thread-safe mode every server is saved as it is when it
+		// is reached, the stores to the others go on meanwhile
+		if (main->thread_safe)
+			pthread_rwlock_rdlock(&server->lock);
+		members[i].id = main->member_ids[i];
+		members[i].weight = main->member_weights[i];
+		members[i].count = server->size;
+		members[i].offset = ftello(out);
+		error = server_write_snapshot(server, out) != 0;
+		if (main->thread_safe)
+			pthread_rwlock_unlock(&server->lock);
+		header.keys += members[i].count;
+	}
+	if (main->thread_safe)
+		pthread_mutex_unlock(&main->topology);
+
+	header.size = ftello(out);
+	if (!error)
+		error = fseeko(out, 0, SEEK_SET) != 0 ||
+				fwrite(&header, sizeof(header), 1, out) != 1 ||
+				fwrite(members, sizeof(snapshot_member), n, out) != n ||
+				fflush(out) != 0 || fsync(fileno(out)) != 0;
+	error = (fclose(out) != 0) || error;
+	if (!error)
+		error = rename(tmp, path) != 0;
+	if (error)
+		unlink(tmp);
+	free(members);
+	free(tmp);
+	return error ? -1 : 0;
+}
+
+// Checks that the entries of a server are sorted by hash, as retrieves
+// binary search them, and that every key and value is inside the file
+// and ends with '\0'
+static int snapshot_entries_valid(const char* map, unsigned long long size,
+								const snapshot_member* member) {
+	const snap_entry *entries = (const snap_entry *)(map + member->offset);
+
+	for (unsigned int i = 0; i < member->count; i++) {
+		const snap_entry *entry = &entries[i];
+		unsigned long long offset = entry->offset;
+
+		if ((i > 0 && entry->hash < entries[i - 1].hash) || offset > size ||
+			size - offset < (unsigned long long)entry->key_len +
+			entry->value_len + 2 || map[offset + entry->key_len] != '\0' ||
+			map[offset + entry->key_len + 1 + entry->value_len] != '\0')
+			return 0;
+	}
+	return 1;
+}
+
+// Checks that a snapshot is complete: the options are ones the load
+// balancer accepts, the tables are inside the file and agree with each
+// other and so do the entries of every server
+static int snapshot_valid(const char* map, unsigned long long size) {
+	const snapshot_header *header = (const snapshot_header *)map;
+
+	if (size < sizeof(snapshot_header) ||
+		memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+		header->version != SNAPSHOT_VERSION ||
+		header->byte_order != SNAPSHOT_BYTE_ORDER ||
+		header->size != size || header->engine > LB_ENGINE_JUMP ||
+		header->key_hash > LB_HASH_WY || header->replicas == 0 ||
+		header->replicas > MAX_REPLICAS)
+		return 0;
+	// NaN fails every comparison
+	if (!(header->epsilon >= 0) ||
+		(header->epsilon > 0 && header->engine != LB_ENGINE_RING) ||
+		(header->replicas > 1 && (header->engine != LB_ENGINE_RING ||
+		header->epsilon > 0)) ||
+		(header->engine == LB_ENGINE_MAGLEV &&
+		!is_prime(header->maglev_size)) ||
+		(header->max_spill > 0 && header->max_spill >= header->ncopies))
+		return 0;
+
+	unsigned long long tables = sizeof(snapshot_header) +
+		(unsigned long long)header->nmembers * sizeof(snapshot_member) +
+		(unsigned long long)header->ncopies * sizeof(snapshot_copy);
+	if (tables > size)
+		return 0;
+
+	const snapshot_member *members = (const snapshot_member *)(header + 1);
+	for (unsigned int i = 0; i < header->nmembers; i++) {
+		if ((i > 0 && members[i].id <= members[i - 1].id) ||
+			members[i].weight == 0 || members[i].offset % 8 ||
+			members[i].offset < tables || members[i].offset > size ||
+			(size - members[i].offset) / sizeof(snap_entry) < members[i].count ||
+			!snapshot_entries_valid(map, size, &members[i]))
+			return 0;
+	}
+
+	const snapshot_copy *copies =
+		(const snapshot_copy *)(members + header->nmembers);
+	for (unsigned int i = 0; i < header->ncopies; i++) {
+		unsigned int low = 0, high = header->nmembers;
+
+		if (i > 0 && copies[i].hash < copies[i - 1].hash)
+			return 0;
+		while (low < high) {
+			unsigned int mid = (low + high) / 2;
+
+			if (members[mid].id < copies[i].server_id)
+				low = mid + 1;
+			else
+				high = mid;
 		}
+		if (low == header->nmembers || members[low].id != copies[i].server_id)
+			return 0;
 	}
-	// Returning the neighbour so we can balance the load
-	if (main->h_ring[index + 1] != NULL) {
-		return main->h_ring[index + 1];
-	} else {
-		if (main->elements != 1)  // This means that is only one server in the ring
-			return main->h_ring[0];  // sau index +1 % main-elements
+	return 1;
+}
+
+load_balancer* loader_restore(const char* path, const lb_config* config) {
+	DIE(path == NULL, "Error - no snapshot");
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(snapshot_header)) {
+		close(fd);
+		return NULL;
+	}
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	if (!snapshot_valid(map, st.st_size)) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	// The placement comes from the snapshot, the rest from the caller
+	const snapshot_header *header = (const snapshot_header *)map;
+	lb_config restored;
+	if (config != NULL)
+		restored = *config;
+	else
+		init_lb_config(&restored);
+	restored.engine = header->engine;
+	restored.key_hash = header->key_hash;
+	restored.maglev_size = header->maglev_size;
+	restored.epsilon = header->epsilon;
+	restored.replicas = header->replicas;
+	if ((restored.thread_safe && (restored.engine != LB_ENGINE_RING ||
+		restored.epsilon > 0 || restored.replicas > 1)) ||
+		(restored.read_cache && restored.replicas > 1)) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	load_balancer *main = init_load_balancer_config(&restored);
+	main->snapshot = map;
+	main->snapshot_size = st.st_size;
+	main->max_spill = header->max_spill;
+	main->keys = header->keys;
+
+	// Only the tables are read now: the objects stay in the file until
+	// they are moved or replaced
+	const snapshot_member *members = (const snapshot_member *)(header + 1);
+	for (unsigned int i = 0; i < header->nmembers; i++) {
+		server_memory *server = init_server_memory_shared(main->slab);
+
+		server_set_hash(server, main->hash);
+		server_attach_snapshot(server, map, (const snap_entry *)(map +
+								members[i].offset), members[i].count);
+		member_insert(main, members[i].id, server, members[i].weight);
+	}
+
+	const snapshot_copy *copies =
+		(const snapshot_copy *)(members + header->nmembers);
+	ring_reserve(main, header->ncopies);
+	for (unsigned int i = 0; i < header->ncopies; i++) {
+		main->hashes[i] = copies[i].hash;
+		main->server_ids[i] = copies[i].server_id;
+		main->servers[i] = main->members[member_find(main,
+												copies[i].server_id)];
+	}
+	main->elements = header->ncopies;
+	rebuild_routing(main);
+	if (main->thread_safe) {
+		free(main->view);
+		main->view = view_create(main);
+	}
+	return main;
+}
+
+int loader_checkpoint(load_balancer* main) {
+	DIE(main == NULL, "Error - no load balancer");
+	if (main->journal == NULL)
+		return -1;
+	// a store which finds the journal big while a checkpoint runs skips it
+	if (__atomic_exchange_n(&main->checkpointing, 1, __ATOMIC_ACQUIRE))
+		return 0;
+
+	// Every record before this size was applied before the snapshot
+	// starts, the later ones are kept
+	unsigned long long size = journal_size(main->journal);
+	int error = loader_snapshot(main, main->checkpoint_path);
+	if (error == 0)
+		journal_discard(main->journal, size);
+	__atomic_store_n(&main->checkpointing, 0, __ATOMIC_RELEASE);
+	return error;
+}
+
+// A failed checkpoint loses nothing: the journal still holds every
+// change, so it is reported and the journal keeps growing
+static void checkpoint_if_big(load_balancer* main) {
+	unsigned long long size = journal_size(main->journal);
+
+	if (size <= __atomic_load_n(&main->compact_at, __ATOMIC_RELAXED))
+		return;
+	if (loader_checkpoint(main) == 0) {
+		__atomic_store_n(&main->compact_at, main->compact_bytes,
+						__ATOMIC_RELAXED);
+		return;
+	}
+	fprintf(stderr, "Error writing checkpoint %s: %s, retrying later\n",
+			main->checkpoint_path, strerror(errno));
+	__atomic_store_n(&main->compact_at, size + main->compact_bytes,
+					__ATOMIC_RELAXED);
+}
+
+void loader_sync(load_balancer* main) {
+	DIE(main == NULL, "Error - no load balancer");
+	if (main->journal)
+		journal_sync(main->journal);
+}
+
+void free_load_balancer(load_balancer* main) {
+	DIE(main == NULL, "Error - no load balancer");
+	// the last records reach the disk before anything is freed
+	if (main->journal) {
+		journal_close(main->journal);
+		free(main->checkpoint_path);
+	}
+
+	// The objects of the servers are freed together with the allocator
+	for (unsigned int i = 0; i < main->nmembers; i++)
+		free_server_tables(main->members[i]);
+	slab_destroy(main->slab);
+	free(main->hashes);
+	free(main->server_ids);
+	free(main->servers);
+	free(main->member_ids);
+	free(main->members);
+	free(main->member_weights);
+	free(main->maglev);
+	if (main->thread_safe) {
+		pthread_mutex_destroy(&main->topology);
+		free(main->view);
+		free(main->prev);
+		free(main->readers);
+	}
+	if (main->snapshot)
+		munmap(main->snapshot, main->snapshot_size);
+	if (main->cache)
+		cache_free(main->cache);
+	stats_free(main->stats);
+	free(main);
+}
+
+// Extra functions
+
+// Returns the position of a server in the members or -1
+int member_find(load_balancer* main, int server_id) {
+	int low = 0, high = (int)main->nmembers - 1;
+
+	while (low <= high) {
+		int mid = (low + high) / 2;
+
+		if (main->member_ids[mid] == server_id)
+			return mid;
+		if (main->member_ids[mid] < server_id)
+			low = mid + 1;
 		else
-			return NULL;
+			high = mid - 1;
 	}
+	return -1;
 }
 
-// Function that redistributes the elements when a new server is added
-void add_redistribute(load_balancer* main, server_info *empty,
-						server_info *full, server_info *before) {
-	if (full == NULL || full->server_id == empty->server_id)
+// Adds a server to the members, keeping them sorted by id
+void member_insert(load_balancer* main, int server_id,
+					server_memory* server, unsigned int weight) {
+	if (main->nmembers == main->members_cap) {
+		main->members_cap = main->members_cap ? 2 * main->members_cap : 8;
+		main->member_ids = realloc(main->member_ids,
+								main->members_cap * sizeof(int));
+		main->members = realloc(main->members,
+							main->members_cap * sizeof(server_memory *));
+		main->member_weights = realloc(main->member_weights,
+								main->members_cap * sizeof(unsigned int));
+		DIE(main->member_ids == NULL || main->members == NULL ||
+			main->member_weights == NULL, "Error growing members");
+	}
+
+	unsigned int poz = 0;
+	while (poz < main->nmembers && main->member_ids[poz] < server_id)
+		poz++;
+	unsigned int count = main->nmembers - poz;
+	memmove(main->member_ids + poz + 1, main->member_ids + poz,
+			count * sizeof(int));
+	memmove(main->members + poz + 1, main->members + poz,
+			count * sizeof(server_memory *));
+	memmove(main->member_weights + poz + 1, main->member_weights + poz,
+			count * sizeof(unsigned int));
+	main->member_ids[poz] = server_id;
+	main->members[poz] = server;
+	main->member_weights[poz] = weight;
+	main->nmembers++;
+}
+
+void member_erase(load_balancer* main, int poz) {
+	unsigned int count = main->nmembers - poz - 1;
+
+	memmove(main->member_ids + poz, main->member_ids + poz + 1,
+			count * sizeof(int));
+	memmove(main->members + poz, main->members + poz + 1,
+			count * sizeof(server_memory *));
+	memmove(main->member_weights + poz, main->member_weights + poz + 1,
+			count * sizeof(unsigned int));
+	main->nmembers--;
+}
+
+// Rebuilds the routing data of the engines which are not the ring
+void rebuild_routing(load_balancer* main) {
+	if (main->engine == LB_ENGINE_MAGLEV && main->nmembers > 0)
+		maglev_build(main->maglev, main->maglev_size, main->member_ids,
+					main->member_weights, main->nmembers);
+}
+
+// Moves every object which is not stored on the server that owns it and
+// returns how many were moved
+unsigned int rehome_all(load_balancer* main) {
+	unsigned int moved = 0;
+
+	for (unsigned int i = 0; i < main->nmembers; i++)
+		moved += server_move_if(main->members[i], owner_of, main);
+	return moved;
+}
+
+// Returns the index where an item should be item
+// (the first copy with a greater hash, wrapping around to 0)
+int server_search(load_balancer *main, unsigned int hash_key) {
+	DIE(main == NULL, "Error - no load balancer in add_server");
+	return ring_upper_bound(main->stats, main->hashes, main->elements,
+							hash_key);
+}
+
+// Makes sure the hash ring has room for a number of elements
+void ring_reserve(load_balancer* main, unsigned int size) {
+	DIE(main == NULL, "Error - no load balancer");
+	if (size <= main->max_size)
 		return;
-	server_memory *empty_sv = empty->server, *full_sv = full->server;
-	// Check each object stored previously on the server
-	for (unsigned int i = 0; i < full_sv->hmax; i++) {
-		ll_node_t *curr = full_sv->buckets[i]->head;
-		while (curr != NULL) {
-			unsigned int key_hash =
-			hash_function_string(((info_obj *)(curr->data))->key);
-
-			// if the new server is the one after "0" value-point on the hashring
-			if (main->h_ring[0]->tag_server == empty->tag_server) {
-				if ((key_hash < empty->hash) || key_hash >= before->hash) {
-					// restore the object if necessary
-					ll_node_t *curr_cp = curr;
-					curr = curr->next;
-					object_redistribution(empty_sv, full_sv, curr_cp);
-				} else {
-					curr = curr->next;
-				}
-			} else {
-				if (key_hash < empty->hash && key_hash >= before->hash) {
-					// restore the object if necessary
-					ll_node_t *curr_cp = curr;
-					curr = curr->next;
-					object_redistribution(empty_sv, full_sv, curr_cp);
-				} else {
-					curr = curr->next;
-				}
-			}
-		}
+
+	unsigned int max_size = main->max_size ? main->max_size : INITIAL_SIZE;
+	while (max_size < size)
+		max_size *= 2;
+
+	main->hashes = realloc(main->hashes, max_size * sizeof(unsigned int));
+	DIE(main->hashes == NULL, "Error growing hash ring");
+	main->server_ids = realloc(main->server_ids, max_size * sizeof(int));
+	DIE(main->server_ids == NULL, "Error growing hash ring");
+	main->servers = realloc(main->servers, max_size * sizeof(server_memory *));
+	DIE(main->servers == NULL, "Error growing hash ring");
+	main->max_size = max_size;
+}
+
+// Function that adds a new copy of a server to the hashring and returns
+// the position where it was placed
+unsigned int src_add_server(load_balancer* main, int tag_nr,
+							int server_id, server_memory* server) {
+	DIE(main == NULL, "Error - no load balancer");
+	ring_reserve(main, main->elements + 1);
+
+	int tag_server = tag_nr * TAG_STRIDE + server_id;
+	unsigned int hash = hash_function_servers(&tag_server);
+
+	// The copies are sorted by hash and the ones with the same hash by
+	// server id, so the new copy goes after all the smaller or equal ones
+	unsigned int low = 0, high = main->elements;
+	while (low < high) {
+		unsigned int mid = (low + high) / 2;
+
+		if (main->hashes[mid] < hash ||
+			(main->hashes[mid] == hash && main->server_ids[mid] <= server_id))
+			low = mid + 1;
+		else
+			high = mid;
 	}
+
+	shift_right(main, low);
+	main->hashes[low] = hash;
+	main->server_ids[low] = server_id;
+	main->servers[low] = server;
+	return low;
 }
 
-// Function that moves an object from a server to the other
+// Function that redistributes the elements when a new copy is added
+void add_redistribute(load_balancer* main, unsigned int index) {
+	DIE(main == NULL, "Error - no load balancer");
+	if (main->elements < 2)
+		return;
+	unsigned int n = main->elements;
+	// The objects come from the copy after the new one
+	unsigned int next = (index + 1) % n;
+	unsigned int before = main->hashes[(index + n - 1) % n];
+	unsigned int hash = main->hashes[index];
+	if (main->server_ids[next] == main->server_ids[index])
+		return;
+
+	// Only the objects from the arc [before, hash) have to be moved, and
+	// the hash index of the server finds them without a full scan. They
+	// change hands as they are, nothing is copied or allocated again
+	// (if the new server is the one after "0" value-point on the hashring
+	// the arc goes over the end of the ring)
+	move_arc(main->servers[index], main->servers[next], before, hash,
+			index == 0);
+}
+
+// Function that moves an object from a server to the other: it is
+// unlinked from the first one and linked into the second as it is
 void object_redistribution(server_memory *empty_sv, server_memory *full_sv,
-														ll_node_t *curr) {
-	// Get the key-value pair
-	char *key = ((info_obj *)(curr->data))->key;
-	char *value = ((info_obj *)(curr->data))->value;
+														info_obj *obj) {
+	server_move_object(empty_sv, full_sv, obj);
+}
 
-	// Delete from the previous server and add to the new one
-	server_store(empty_sv, key, value);
-	server_remove(full_sv, key);
+// Shifting the hashring with one position to the right, from poz onwards
+void shift_right(load_balancer* main, unsigned int poz) {
+	unsigned int count = main->elements - poz;
+
+	memmove(main->hashes + poz + 1, main->hashes + poz,
+			count * sizeof(unsigned int));
+	memmove(main->server_ids + poz + 1, main->server_ids + poz,
+			count * sizeof(int));
+	memmove(main->servers + poz + 1, main->servers + poz,
+			count * sizeof(server_memory *));
+	main->elements++;
 }
 
-// Getting the (copy of the) server behind our current position
-server_info* get_sv_behind(load_balancer* main, int server_tag) {
-	DIE(main == NULL, "Error - no load balancer in add_server");
+// Removing all the copies of a server from the hashring in a single pass
+server_memory* server_remover(load_balancer* main, int server_id) {
+	DIE(main == NULL, "Error - no load balancer");
 
-	server_info *server_out;
-	unsigned int index = 0, ok = 1;
-	while (ok && index < main->elements) {
-		// looking for the actual server to return its back-neighbour
-		if (((server_info *)(main->h_ring[index]))->tag_server == server_tag) {
-			if (index == 0)
-				// if my server is on the 1st position, its back-neighbour
-				// is the last server on the hashring
-				server_out = ((server_info *)(main->h_ring[main->elements - 1]));
-			else
-				server_out = ((server_info *)(main->h_ring[index - 1]));
-			ok = 0;
+	unsigned int kept = 0;
+	server_memory *server_out = NULL;
+	for (unsigned int index = 0; index < main->elements; index++) {
+		if (main->server_ids[index] == server_id) {
+			server_out = main->servers[index];
 		} else {
-			index++;
+			// Compacting the ring over the removed copies
+			main->hashes[kept] = main->hashes[index];
+			main->server_ids[kept] = main->server_ids[index];
+			main->servers[kept] = main->servers[index];
+			kept++;
 		}
 	}
+	main->elements = kept;
 	return server_out;
 }
 
-// Shifting the hashring with one position to the right
-void shift_right(load_balancer* main, int poz) {
-	for (int i = main->elements + 1; i > poz; i--) {
-		main->h_ring[i] = main->h_ring[i - 1];
+void loader_print_distribution(load_balancer *main, FILE *out) {
+	DIE(main == NULL, "Error - no load balancer");
+	static const char *engines[] = {"ring", "maglev", "jump"};
+	unsigned int servers = main->nmembers;
+
+	fprintf(out, "engine %s servers %u copies %u\n", engines[main->engine],
+			servers, main->engine == LB_ENGINE_RING ? main->elements : 0);
+	if (servers == 0)
+		return;
+
+	// The share of the keyspace owned by each server
+	double *keyspace = calloc(servers, sizeof(double));
+	DIE(keyspace == NULL, "Error allocating distribution report");
+	if (main->engine == LB_ENGINE_RING) {
+		// Each copy owns the arc between its predecessor and itself
+		for (unsigned int i = 0; i < main->elements; i++) {
+			unsigned int prev = main->hashes[i == 0 ? main->elements - 1 : i - 1];
+			double arc = (double)(main->hashes[i] - prev);
+			if (main->elements == 1)
+				arc = 4294967296.0;
+
+			keyspace[member_find(main, main->server_ids[i])] +=
+				arc / 4294967296.0;
+		}
+	} else if (main->engine == LB_ENGINE_MAGLEV) {
+		for (unsigned int i = 0; i < main->maglev_size; i++)
+			keyspace[main->maglev[i]] += 1.0 / main->maglev_size;
+	} else {
+		for (unsigned int i = 0; i < servers; i++)
+			keyspace[i] = 1.0 / servers;
+	}
+
+	double max_space = 0, total_keys = 0, max_keys = 0;
+	for (unsigned int i = 0; i < servers; i++) {
+		if (keyspace[i] > max_space)
+			max_space = keyspace[i];
+		if (main->members[i]->size > max_keys)
+			max_keys = main->members[i]->size;
+		total_keys += main->members[i]->size;
+	}
+
+	fprintf(out, "keyspace max/mean %.3f\n", max_space * servers);
+	if (main->replicas > 1)
+		fprintf(out, "replicas %u\n", main->replicas);
+	if (main->epsilon > 0)
+		fprintf(out, "bounded epsilon %.3f max spill %u\n",
+				main->epsilon, main->max_spill);
+	if (total_keys > 0)
+		fprintf(out, "keys max/mean %.3f (total %.0f)\n",
+				max_keys * servers / total_keys, total_keys);
+	free(keyspace);
+}
+
+unsigned long long loader_keys_moved(load_balancer *main) {
+	DIE(main == NULL, "Error - no load balancer");
+	return main->moved;
+}
+
+double loader_load_ratio(load_balancer *main) {
+	DIE(main == NULL, "Error - no load balancer");
+	unsigned int max_keys = 0;
+
+	if (main->keys == 0)
+		return 0;
+	for (unsigned int i = 0; i < main->nmembers; i++)
+		if (main->members[i]->size > max_keys)
+			max_keys = main->members[i]->size;
+	return (double)max_keys * main->nmembers / main->keys;
+}
+
+double loader_read_ratio(load_balancer *main) {
+	DIE(main == NULL, "Error - no load balancer");
+	unsigned long long max_reads = 0, reads = 0;
+
+	for (unsigned int i = 0; i < main->nmembers; i++) {
+		reads += main->members[i]->reads;
+		if (main->members[i]->reads > max_reads)
+			max_reads = main->members[i]->reads;
 	}
+	if (reads == 0)
+		return 0;
+	return (double)max_reads * main->nmembers / reads;
 }
 
-// Shifting the hashring with one position to the left
-void shift_left(load_balancer *main, int poz) {
+double loader_cache_hit_rate(load_balancer *main) {
 	DIE(main == NULL, "Error - no load balancer");
-	for (unsigned int i = poz; i < main->elements - 1; i++) {
-		main->h_ring[i] = main->h_ring[i + 1];
+	unsigned long long hits, misses;
+
+	if (main->cache == NULL)
+		return 0;
+	cache_counts(main->cache, &hits, &misses);
+	return hits + misses ? (double)hits / (hits + misses) : 0;
+}
+
+// Returns the upper bound (in ns) of the bucket which holds the given
+// fraction of the operations of a latency histogram
+static unsigned long long latency_percentile(const unsigned long long *hist,
+											unsigned long long count,
+											double fraction) {
+	unsigned long long seen = 0, rank = (unsigned long long)(fraction * count);
+
+	for (int i = 0; i < LB_LATENCY_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen > rank)
+			return 2ull << i;
 	}
-	main->h_ring[main->elements - 1] = NULL;
-	main->elements--;
+	return 2ull << (LB_LATENCY_BUCKETS - 1);
 }
 
-// Removing a copy from the hashring
-server_memory* server_remover(load_balancer* main, int server_id) {
+void loader_print_stats(load_balancer *main, FILE *out) {
 	DIE(main == NULL, "Error - no load balancer");
+	static const char *ops[] = {"store", "retrieve", "add_server",
+								"remove_server"};
+	unsigned int probes[PROBE_BUCKETS] = {0};
+	lb_stats total;
 
-	unsigned int index = 0, ok = 1;
-	server_memory *server_out;
-	while (ok && index < main->elements) {
-		if (main->h_ring[index]->server_id == server_id) {
-			ok = 0;
-			server_out = main->h_ring[index]->server;
-			free(main->h_ring[index]);
-			shift_left(main, index);
-		} else {
-			index++;
-		}
+	fprintf(out, "stats counters %s\n",
+			stats_collect(main->stats, &total) ? "on" :
+			"off (build with -DLB_STATS)");
+
+	// The servers are measured now, under their lock in thread-safe mode
+	if (main->thread_safe)
+		pthread_mutex_lock(&main->topology);
+	for (unsigned int i = 0; i < main->nmembers; i++) {
+		server_memory *server = main->members[i];
+		server_stats stats;
+
+		if (main->thread_safe)
+			pthread_rwlock_rdlock(&server->lock);
+		server_get_stats(server, &stats);
+		if (main->thread_safe)
+			pthread_rwlock_unlock(&server->lock);
+
+		fprintf(out, "server %d keys %u bytes %llu slots %u tombstones %u\n",
+				main->member_ids[i], stats.keys, stats.bytes, stats.slots,
+				stats.tombstones);
+		for (int j = 0; j < PROBE_BUCKETS; j++)
+			probes[j] += stats.probes[j];
+	}
+	if (main->thread_safe)
+		pthread_mutex_unlock(&main->topology);
+
+	fprintf(out, "probe groups");
+	for (int j = 0; j < PROBE_BUCKETS; j++)
+		fprintf(out, " %d%s:%u", j + 1, j == PROBE_BUCKETS - 1 ? "+" : "",
+				probes[j]);
+	fprintf(out, "\n");
+
+	unsigned long long *counters = total.counters;
+	fprintf(out, "stores %llu retrieves %llu hits %llu\n",
+			counters[LB_STAT_STORES], counters[LB_STAT_RETRIEVES],
+			counters[LB_STAT_HITS]);
+	fprintf(out, "ring searches %llu steps %llu\n",
+			counters[LB_STAT_RING_SEARCHES], counters[LB_STAT_RING_STEPS]);
+	fprintf(out, "keys moved %llu\n", loader_keys_moved(main));
+	if (main->cache) {
+		unsigned long long hits, misses;
+
+		cache_counts(main->cache, &hits, &misses);
+		fprintf(out, "read cache hits %llu misses %llu\n", hits, misses);
+	}
+
+	// Latency of every kind of operation: count, percentiles and the
+	// buckets which are not empty (<2^(i+1) ns)
+	for (int op = 0; op < LB_NR_OPS; op++) {
+		const unsigned long long *hist = total.latency[op];
+		unsigned long long count = 0;
+
+		for (int i = 0; i < LB_LATENCY_BUCKETS; i++)
+			count += hist[i];
+		if (count == 0)
+			continue;
+
+		fprintf(out, "latency %s count %llu p50 <%lluns p99 <%lluns"
+				" p999 <%lluns\n", ops[op], count,
+				latency_percentile(hist, count, 0.5),
+				latency_percentile(hist, count, 0.99),
+				latency_percentile(hist, count, 0.999));
+		fprintf(out, "  histogram");
+		for (int i = 0; i < LB_LATENCY_BUCKETS; i++)
+			if (hist[i])
+				fprintf(out, " <%llu:%llu", 2ull << i, hist[i]);
+		fprintf(out, "\n");
 	}
-	return server_out;
 }
@@ -2,16 +2,77 @@
 #ifndef LOAD_BALANCER_H_
 #define LOAD_BALANCER_H_
 
-#include "server.h"
+#include <stdio.h>
 
-struct server_info;
-typedef struct server_info server_info;
+#include "server.h"
 
 struct load_balancer;
 typedef struct load_balancer load_balancer;
 
+// Placement strategies of the load balancer
+typedef enum lb_engine {
+	LB_ENGINE_RING,  // Consistent hashing on a hash ring (the default)
+	LB_ENGINE_MAGLEV,  // Maglev lookup table: O(1) routing, even balance
+	LB_ENGINE_JUMP  // Jump consistent hash over the servers sorted by id
+} lb_engine;
+
+// Hash functions of the keys
+typedef enum lb_hash {
+	LB_HASH_DJB2,  // Byte at a time djb2 (the default)
+	LB_HASH_WY  // Word at a time wyhash, spreads similar keys much better
+} lb_hash;
+
+// Options of a load balancer (init_lb_config() sets the defaults)
+typedef struct lb_config {
+	lb_engine engine;  // How keys are placed on the servers
+	// Hash of the keys, used both for their position on the ring and
+	// for the tables of the servers (which index their keys by it)
+	lb_hash key_hash;
+	unsigned int maglev_size;  // Slots of the Maglev table (a prime)
+	// Bounded loads (ring only): a server never gets new keys once it
+	// holds more than (1 + epsilon) * average keys, 0 turns it off
+	double epsilon;
+	// 1 to allow stores and retrieves from many threads, together with
+	// adds and removes of servers (ring engine without bounded loads)
+	int thread_safe;
+	// Path of the journal of the stores and server changes (NULL for
+	// none). An existing journal is replayed when the load balancer is
+	// created, after the snapshot of its last checkpoint
+	const char *journal;
+	// Longest time (in microseconds) a journal record waits to be synced
+	unsigned int journal_sync_us;
+	// A checkpoint is taken once the journal grows past this size (0 for
+	// never, loader_checkpoint() can still be called). If it fails, the
+	// error is printed and it is tried again after as many more bytes
+	unsigned long long journal_compact_bytes;
+	// Servers which store every key (ring engine without bounded loads,
+	// not thread-safe): the next distinct ones clockwise from its hash.
+	// A retrieve reads the replica which served the fewest reads
+	unsigned int replicas;
+	// Entries of a cache of the keys read lately: a hot key skips the ring
+	// and the table of its server (0 for none, not thread-safe). Not with
+	// replicas: a cached key would always be read from the same replica
+	// and its reads would not be counted
+	unsigned int read_cache;
+} lb_config;
+
+void init_lb_config(lb_config *config);
+
 load_balancer* init_load_balancer();
 
+/**
+ * init_load_balancer_config() - Creates a load balancer with options.
+ * @arg1: Options of the load balancer.
+ *
+ * The ring engine moves only the keys of the split or removed arcs when
+ * the servers change. The Maglev and jump engines route a key in O(1)
+ * but check every stored key when a server is added or removed. Maglev
+ * uses the number of copies of a server as its weight; jump hash ignores
+ * weights and only moves the minimum number of keys when servers are
+ * added and removed in increasing order of their id.
+ */
+load_balancer* init_load_balancer_config(const lb_config *config);
+
 void free_load_balancer(load_balancer* main);
 
 /**
@@ -41,6 +102,127 @@ void loader_store(load_balancer* main, char* key, char* value, int* server_id);
  */
 char* loader_retrieve(load_balancer* main, char* key, int* server_id);
 
+/**
+ * loader_store_n() - loader_store() for a key and a value given as slices.
+ * @arg1: Load balancer which distributes the work.
+ * @arg2: Key (it doesn't have to end with '\0').
+ * @arg3: Length of the key.
+ * @arg4: Value (it doesn't have to end with '\0').
+ * @arg5: Length of the value.
+ * @arg6: This function will RETURN the server ID via this parameter.
+ *
+ * Lets a caller pass pieces of a bigger buffer (e.g. a mapped input
+ * file) without copying them first.
+ */
+void loader_store_n(load_balancer* main, const char* key, unsigned int key_len,
+					const char* value, unsigned int value_len,
+					int* server_id);
+
+/**
+ * loader_retrieve_n() - loader_retrieve() for a key given as a slice.
+ * @arg1: Load balancer which distributes the work.
+ * @arg2: Key (it doesn't have to end with '\0').
+ * @arg3: Length of the key.
+ * @arg4: This function will RETURN the server ID via this parameter.
+ * @arg5: This function will RETURN the length of the value via this
+ *        parameter when the key is found (NULL if not needed).
+ *
+ * Return: the value (ended with '\0') or NULL if the key is missing.
+ */
+char* loader_retrieve_n(load_balancer* main, const char* key,
+						unsigned int key_len, int* server_id,
+						unsigned int* value_len);
+
+/**
+ * loader_retrieve_copy() - Copies the value associated with the key.
+ * @arg1: Load balancer which distributes the work.
+ * @arg2: Key represented as a string.
+ * @arg3: Buffer which receives the value (cut to fit, ended with '\0').
+ * @arg4: Size of the buffer.
+ * @arg5: This function will RETURN the server ID via this parameter.
+ *
+ * Return: the buffer or NULL if the key does not exist. In thread-safe
+ * mode loader_retrieve() returns a value which another thread may
+ * overwrite; this copy is taken under the lock of the server.
+ */
+char* loader_retrieve_copy(load_balancer* main, char* key, char* buffer,
+						unsigned int size, int* server_id);
+
+/**
+ * loader_store_batch() - Stores many key-value pairs at once.
+ * @arg1: Load balancer which distributes the work.
+ * @arg2: Keys represented as strings.
+ * @arg3: Values represented as strings.
+ * @arg4: Number of pairs.
+ * @arg5: This function will RETURN the server ID of every pair
+ *        (in the order of the keys) via this parameter.
+ *
+ * Same result as calling loader_store() for every pair in order, but
+ * the keys are hashed up front and routed in ring order, and the server
+ * slots are prefetched a few keys ahead.
+ */
+void loader_store_batch(load_balancer* main, char** keys, char** values,
+						unsigned int count, int* server_ids);
+
+/**
+ * loader_retrieve_batch() - Gets the values of many keys at once.
+ * @arg1: Load balancer which distributes the work.
+ * @arg2: Keys represented as strings.
+ * @arg3: Number of keys.
+ * @arg4: This function will RETURN the server ID of every key via
+ *        this parameter.
+ * @arg5: This function will RETURN the value of every key (or NULL)
+ *        via this parameter.
+ */
+void loader_retrieve_batch(load_balancer* main, char** keys,
+						unsigned int count, int* server_ids, char** values);
+
+// A key resolved to the server which owns it. It stays valid until a
+// server is added or removed
+typedef struct lb_route {
+	unsigned int hash;
+	int server_id;
+	server_memory *server;
+} lb_route;
+
+/**
+ * loader_route_n() - Finds the server which owns a key.
+ * @arg1: Load balancer which distributes the work.
+ * @arg2: Key (it doesn't have to end with '\0').
+ * @arg3: Length of the key.
+ * @arg4: This function will RETURN the route via this parameter.
+ *
+ * Splits a store or a retrieve in two steps, so the keys can be routed
+ * on one thread and applied on others. Only for the placements where a
+ * key has a single fixed owner (no bounded loads, replicas or read
+ * cache).
+ */
+void loader_route_n(load_balancer* main, const char* key,
+					unsigned int key_len, lb_route* route);
+
+/**
+ * loader_store_routed() - loader_store_n() for a routed key.
+ * @arg1: Load balancer which distributes the work.
+ * @arg2: Route of the key, from loader_route_n().
+ * @arg3: Key.
+ * @arg4: Length of the key.
+ * @arg5: Value.
+ * @arg6: Length of the value.
+ *
+ * With a thread-safe load balancer, many threads may apply routed keys
+ * at the same time as long as each server is used by one of them and
+ * no server is added or removed meanwhile.
+ */
+void loader_store_routed(load_balancer* main, const lb_route* route,
+						const char* key, unsigned int key_len,
+						const char* value, unsigned int value_len);
+
+// loader_retrieve_n() for a routed key (the value stays valid until the
+// key is stored again)
+char* loader_retrieve_routed(load_balancer* main, const lb_route* route,
+							const char* key, unsigned int key_len,
+							unsigned int* value_len);
+
 /**
  * load_add_server() - Adds a new server to the system.
  * @arg1: Load balancer which distributes the work.
@@ -49,8 +231,26 @@ char* loader_retrieve(load_balancer* main, char* key, int* server_id);
  * The load balancer will generate 3 replica TAGs and it will
  * place them inside the hash ring. The neighbor servers will 
  * distribute some the objects to the added server.
+ * Return: 0 on success, -1 if a server with this ID is already in the
+ * system (nothing changes then).
  */
-void loader_add_server(load_balancer* main, int server_id);
+int loader_add_server(load_balancer* main, int server_id);
+
+/**
+ * loader_add_server_weighted() - Adds a new server with a given weight.
+ * @arg1: Load balancer which distributes the work.
+ * @arg2: ID of the new server.
+ * @arg3: Number of replica TAGs (virtual nodes) placed in the hash ring.
+ *
+ * A server with more replicas owns a bigger part of the hash ring, so the
+ * number of replicas should follow the capacity of the server. More
+ * replicas also lower the variance of the load between servers.
+ * loader_add_server() is the same as using 3 replicas.
+ * Return: 0 on success, -1 if a server with this ID is already in the
+ * system (nothing changes then).
+ */
+int loader_add_server_weighted(load_balancer* main, int server_id,
+								int vnodes);
 
 /**
  * load_remove_server() - Removes a specific server from the system.
@@ -59,28 +259,151 @@ void loader_add_server(load_balancer* main, int server_id);
  *
  * The load balancer will distribute ALL objects stored on the
  * removed server and will delete ALL replicas from the hash ring.
+ * Return: 0 on success, -1 if there is no server with this ID.
  */
-void loader_remove_server(load_balancer* main, int server_id);
+int loader_remove_server(load_balancer* main, int server_id);
 
-server_info* create_h_ring_entry(load_balancer* main, int tag_nr,
-                            int server_id, server_memory* server);
+/**
+ * loader_print_distribution() - Reports how balanced the servers are.
+ * @arg1: Load balancer which distributes the work.
+ * @arg2: Stream where the report is written.
+ *
+ * Prints the max/mean ratio of the hash ring share owned by a server
+ * and the max/mean ratio of the number of keys stored on a server
+ * (1.000 means a perfect balance).
+ */
+void loader_print_distribution(load_balancer *main, FILE *out);
 
-server_info* src_add_server(load_balancer* main, server_info* info);
+/**
+ * loader_load_ratio() - Returns the max/mean number of keys of a server.
+ * @arg1: Load balancer which distributes the work.
+ *
+ * With bounded loads this stays under 1 + epsilon (rounded up to a
+ * whole key per server).
+ */
+double loader_load_ratio(load_balancer *main);
 
-server_info* get_sv_behind(load_balancer* main, int server_tag);
+/**
+ * loader_read_ratio() - Returns the max/mean number of reads of a server.
+ * @arg1: Load balancer which distributes the work.
+ *
+ * With a skewed access pattern the server of the hottest keys bounds
+ * the throughput of the whole system; replicas spread those reads.
+ * The reads are not counted in thread-safe mode.
+ */
+double loader_read_ratio(load_balancer *main);
 
-void add_redistribute(load_balancer* main, server_info* empty,
-                        server_info* full, server_info *before);
+/**
+ * loader_cache_hit_rate() - Returns the share of the retrieves which were
+ *                           answered by the read cache.
+ * @arg1: Load balancer which distributes the work.
+ *
+ * Return: 0 without a read cache.
+ */
+double loader_cache_hit_rate(load_balancer *main);
 
-void object_redistribution(server_memory *empty_sv,
-            server_memory *full_sv, ll_node_t *curr);
+/**
+ * loader_keys_moved() - Returns how many keys changed servers so far.
+ * @arg1: Load balancer which distributes the work.
+ *
+ * Counts the keys moved by loader_add_server() and
+ * loader_remove_server(). With bounded loads every key is placed again
+ * after a change, and all of them are counted.
+ */
+unsigned long long loader_keys_moved(load_balancer *main);
 
-void shift_right(load_balancer* main, int poz);
+/**
+ * loader_print_stats() - Dumps the metrics of the load balancer.
+ * @arg1: Load balancer which distributes the work.
+ * @arg2: Stream where the metrics are written.
+ *
+ * The figures of the servers (keys, bytes, slots, tombstones and how many
+ * groups of slots a lookup probes) are always computed on the spot. The
+ * counters of operations and ring searches and the latency histograms
+ * are only kept when the load balancer is built with -DLB_STATS; they
+ * count the operations of this load balancer only.
+ */
+void loader_print_stats(load_balancer *main, FILE *out);
 
-void shift_left(load_balancer *main, int poz);
+/**
+ * loader_snapshot() - Saves the servers and their objects to a file.
+ * @arg1: Load balancer which distributes the work.
+ * @arg2: Path of the snapshot (replaced only once it is complete).
+ *
+ * The file holds the placement options, the servers with their weights,
+ * the copies of the hash ring and, for every server, its entries sorted
+ * by hash followed by the keys and values. The numbers are written in
+ * the byte order of the machine. In thread-safe mode the adds and
+ * removes wait, but every server is saved as it is when it is reached.
+ * Return: 0 on success, -1 if the file could not be written.
+ */
+int loader_snapshot(load_balancer* main, const char* path);
+
+/**
+ * loader_restore() - Creates a load balancer from a snapshot.
+ * @arg1: Path of the snapshot.
+ * @arg2: Options of the load balancer (NULL for the defaults). The
+ *        engine, the key hash, the Maglev size and epsilon are taken
+ *        from the snapshot instead.
+ *
+ * The file is mapped and checked with one pass over the entries of the
+ * servers; no object is copied. Retrieves binary search the entries of
+ * the server in the file; an object is only copied in memory when a
+ * store or a remove changes it or a server change moves it (all the
+ * objects of a server are copied at once then).
+ * Return: the load balancer or NULL if the file can't be read, is not
+ * a complete and valid snapshot or its placement can't be used with the
+ * options (e.g. a Maglev snapshot in thread-safe mode).
+ */
+load_balancer* loader_restore(const char* path, const lb_config* config);
+
+/**
+ * loader_checkpoint() - Compacts the journal of the load balancer.
+ * @arg1: Load balancer which distributes the work.
+ *
+ * Saves a snapshot next to the journal (its path ends in ".snapshot")
+ * and drops the journal records it holds. Records appended while the
+ * snapshot is written are kept, and replaying a record which is already
+ * in the snapshot gives the same result.
+ * Return: 0 on success, -1 without a journal or if the snapshot could
+ * not be written.
+ */
+int loader_checkpoint(load_balancer* main);
+
+/**
+ * loader_sync() - Waits until the journal holds every change so far.
+ * @arg1: Load balancer which distributes the work.
+ *
+ * Stores return before their journal record is synced (at most
+ * journal_sync_us later); adds and removes of servers wait for it.
+ */
+void loader_sync(load_balancer* main);
+
+void ring_reserve(load_balancer* main, unsigned int size);
+
+unsigned int src_add_server(load_balancer* main, int tag_nr,
+							int server_id, server_memory* server);
+
+void add_redistribute(load_balancer* main, unsigned int index);
+
+void object_redistribution(server_memory *empty_sv,
+            server_memory *full_sv, info_obj *obj);
+
+void shift_right(load_balancer* main, unsigned int poz);
 
 int server_search(load_balancer *main, unsigned int hash_key);
 
 server_memory* server_remover(load_balancer* main, int server_id);
 
+int member_find(load_balancer* main, int server_id);
+
+void member_insert(load_balancer* main, int server_id,
+					server_memory* server, unsigned int weight);
+
+void member_erase(load_balancer* main, int poz);
+
+void rebuild_routing(load_balancer* main);
+
+unsigned int rehome_all(load_balancer* main);
+
 #endif  /* LOAD_BALANCER_H_ */
@@ -0,0 +1,77 @@
+/* Copyright 2021 <> */
+#include <stdlib.h>
+#include <string.h>
+
+#include "routing.h"
+#include "utils.h"
+
+// Slot of the table which was not claimed yet
+#define MAGLEV_FREE 0xffffffffu
+
+static unsigned int mix_id(unsigned int x, unsigned int seed) {
+	x ^= seed;
+	x = ((x >> 16u) ^ x) * 0x45d9f3b;
+	x = ((x >> 16u) ^ x) * 0x45d9f3b;
+	x = (x >> 16u) ^ x;
+	return x;
+}
+
+void maglev_build(unsigned int *table, unsigned int size, const int *ids,
+				const unsigned int *weights, unsigned int servers) {
+	DIE(servers == 0, "Error - no servers for the maglev table");
+	unsigned int *offset = malloc(servers * sizeof(unsigned int));
+	unsigned int *skip = malloc(servers * sizeof(unsigned int));
+	unsigned int *next = calloc(servers, sizeof(unsigned int));
+	DIE(offset == NULL || skip == NULL || next == NULL,
+		"Error allocating maglev permutations");
+
+	// The permutation of server i is offset + j * skip (mod size)
+	for (unsigned int i = 0; i < servers; i++) {
+		offset[i] = mix_id(ids[i], 0x9e3779b9u) % size;
+		skip[i] = mix_id(ids[i], 0x7f4a7c15u) % (size - 1) + 1;
+	}
+	memset(table, 0xff, size * sizeof(unsigned int));
+
+	unsigned int filled = 0;
+	while (filled < size) {
+		for (unsigned int i = 0; i < servers && filled < size; i++) {
+			for (unsigned int turn = 0; turn < weights[i] && filled < size;
+				turn++) {
+				unsigned int slot;
+
+				// the next slot of the permutation which is still free
+				do {
+					slot = (offset[i] +
+							(unsigned long long)next[i] * skip[i]) % size;
+					next[i]++;
+				} while (table[slot] != MAGLEV_FREE);
+				table[slot] = i;
+				filled++;
+			}
+		}
+	}
+
+	free(offset);
+	free(skip);
+	free(next);
+}
+
+unsigned int jump_hash(unsigned long long key, unsigned int buckets) {
+	long long bucket = -1, jump = 0;
+
+	while (jump < buckets) {
+		bucket = jump;
+		key = key * 2862933555777941757ull + 1;
+		jump = (bucket + 1) * ((double)(1ll << 31) / (double)((key >> 33) + 1));
+	}
+	return bucket;
+}
+
+int is_prime(unsigned int number) {
+	if (number < 2)
+		return 0;
+	for (unsigned int d = 2; (unsigned long long)d * d <= number; d++)
+		if (number % d == 0)
+			return 0;
+	return 1;
+}
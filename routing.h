@@ -0,0 +1,32 @@
+/* Copyright 2021 <> */
+#ifndef ROUTING_H_
+#define ROUTING_H_
+
+/**
+ * maglev_build() - Fills the lookup table of the Maglev engine.
+ * @arg1: Table which will store, for every slot, the index of a server.
+ * @arg2: Size of the table (a prime number, much bigger than the servers).
+ * @arg3: IDs of the servers.
+ * @arg4: Weights of the servers (how many slots they claim per round).
+ * @arg5: Number of servers (at least one).
+ *
+ * Every server walks its own permutation of the slots and the servers
+ * take turns claiming the first free slot of their permutation, so each
+ * one gets a share of the table proportional to its weight.
+ */
+void maglev_build(unsigned int *table, unsigned int size, const int *ids,
+				const unsigned int *weights, unsigned int servers);
+
+/**
+ * jump_hash() - Jump consistent hash (Lamping and Veach).
+ * @arg1: 64 bit key.
+ * @arg2: Number of buckets (at least one).
+ *
+ * Return: the bucket of the key, in [0, buckets). Adding a bucket at the
+ * end only moves keys to the new bucket.
+ */
+unsigned int jump_hash(unsigned long long key, unsigned int buckets);
+
+int is_prime(unsigned int number);
+
+#endif  /* ROUTING_H_ */
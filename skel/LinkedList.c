@@ -28,13 +28,11 @@ ll_add_nth_node(linked_list_t* list, unsigned int n, const void* new_data)
 {
     if (list == NULL)
         return;
-    DIE(n < 0, "Eroare");
     ll_node_t *new;
     new = malloc(sizeof(ll_node_t));
     DIE(new == NULL, "Eroare");
     new->data = malloc(list->data_size);
     memcpy(new->data, new_data, list->data_size);
-    int nodes_nr = ll_get_size(list);
     if (n >= list->size)
         n = list->size;
     if (n == 0) {
@@ -44,7 +42,7 @@ ll_add_nth_node(linked_list_t* list, unsigned int n, const void* new_data)
     } else {
         ll_node_t *curr;
         curr = list->head;
-        for (int i = 1; i < n; i++)
+        for (unsigned int i = 1; i < n; i++)
             curr = curr->next;
         new->next = curr->next;
         curr->next = new;
@@ -65,13 +63,12 @@ ll_node_t*
 ll_remove_nth_node(linked_list_t* list, unsigned int n)
 {
     if (list == NULL || list->head == NULL)
-        exit;
-    DIE(n < 0, "Eroare");
-    int nodes_nr = ll_get_size(list);
+        return NULL;
     ll_node_t *out;
     if(list->head->next == NULL) {
-        out = list->head->next;
+        out = list->head;
         list->head = NULL;
+        list->size = 0;
         return out;
     }
     if (n >= list->size - 1)
@@ -85,7 +82,7 @@ ll_remove_nth_node(linked_list_t* list, unsigned int n)
         ll_node_t *last, *prev;
         last = list->head->next;
         prev = list->head;
-        for (int i = 1; i < n; i++) {
+        for (unsigned int i = 1; i < n; i++) {
             prev = last;
             last = last->next;
         }
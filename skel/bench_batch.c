@@ -0,0 +1,118 @@
+/* Copyright 2021 <> */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "load_balancer.h"
+#include "utils.h"
+
+// The shape of in/test16.in: 100 servers, 32 hex digit keys and product
+// names as values, scaled up to many more keys
+#define SERVERS 100
+#define KEYS 1000000
+#define BATCH 256
+#define KEY_LENGTH 33
+#define VALUE_LENGTH 64
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static load_balancer* build(void) {
+	load_balancer *main_server = init_load_balancer();
+
+	srand(7);
+	for (int i = 0; i < SERVERS; i++)
+		loader_add_server(main_server, rand() % 100000);
+	return main_server;
+}
+
+// Stores and then retrieves (in a shuffled order) the same keys with
+// per-key calls and with batches, and checks both agree
+int main(int argc, char* argv[]) {
+	unsigned int count = argc > 1 ? atoi(argv[1]) : KEYS;
+	unsigned int batch = argc > 2 ? atoi(argv[2]) : BATCH;
+
+	DIE(count == 0 || batch == 0, "Usage: bench_batch [keys] [batch]");
+	char **keys = malloc(count * sizeof(char *));
+	char **values = malloc(count * sizeof(char *));
+	char **lookups = malloc(count * sizeof(char *));
+	char **found = malloc(count * sizeof(char *));
+	int *ids = malloc(count * sizeof(int));
+	int *batch_ids = malloc(count * sizeof(int));
+	DIE(!keys || !values || !lookups || !found || !ids || !batch_ids,
+		"Error allocating the workload");
+
+	srand(42);
+	for (unsigned int i = 0; i < count; i++) {
+		keys[i] = malloc(KEY_LENGTH);
+		values[i] = malloc(VALUE_LENGTH);
+		DIE(!keys[i] || !values[i], "Error allocating the workload");
+		snprintf(keys[i], KEY_LENGTH, "%08x%08x%08x%08x",
+				rand(), rand(), rand(), i);
+		snprintf(values[i], VALUE_LENGTH, "Product %u with a name of %d",
+				i, rand() % 1000);
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned int j = rand() % (i + 1);
+
+		lookups[i] = lookups[j];
+		lookups[j] = keys[i];
+	}
+
+	load_balancer *single = build(), *batched = build();
+	double start = now();
+	for (unsigned int i = 0; i < count; i++)
+		loader_store(single, keys[i], values[i], &ids[i]);
+	double single_store = now() - start;
+
+	start = now();
+	for (unsigned int i = 0; i < count; i += batch) {
+		unsigned int n = count - i < batch ? count - i : batch;
+
+		loader_store_batch(batched, keys + i, values + i, n, batch_ids + i);
+	}
+	double batch_store = now() - start;
+	DIE(memcmp(ids, batch_ids, count * sizeof(int)),
+		"Error - the batch stored keys on other servers");
+
+	start = now();
+	for (unsigned int i = 0; i < count; i++)
+		found[i] = loader_retrieve(single, lookups[i], &ids[i]);
+	double single_retrieve = now() - start;
+
+	start = now();
+	for (unsigned int i = 0; i < count; i += batch) {
+		unsigned int n = count - i < batch ? count - i : batch;
+
+		loader_retrieve_batch(batched, lookups + i, n, batch_ids + i,
+							found + i);
+	}
+	double batch_retrieve = now() - start;
+	for (unsigned int i = 0; i < count; i++)
+		DIE(!found[i], "Error - the batch lost a key");
+
+	printf("keys %u batch %u\n", count, batch);
+	printf("store    per key %.0f/s batch %.0f/s\n",
+			count / single_store, count / batch_store);
+	printf("retrieve per key %.0f/s batch %.0f/s\n",
+			count / single_retrieve, count / batch_retrieve);
+
+	free_load_balancer(single);
+	free_load_balancer(batched);
+	for (unsigned int i = 0; i < count; i++) {
+		free(keys[i]);
+		free(values[i]);
+	}
+	free(keys);
+	free(values);
+	free(lookups);
+	free(found);
+	free(ids);
+	free(batch_ids);
+	return 0;
+}
@@ -0,0 +1,76 @@
+/* Copyright 2021 <> */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "load_balancer.h"
+#include "utils.h"
+
+#define SERVERS 100
+#define KEYS 200000
+#define KEY_LENGTH 17
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Stores the same keys with a shrinking epsilon and prints the max/mean
+// load, how far keys spilled and the cost of the extra probes
+int main(int argc, char* argv[]) {
+	double epsilons[] = {0, 1, 0.5, 0.25, 0.1, 0.05};
+	int servers = argc > 1 ? atoi(argv[1]) : SERVERS;
+	int count = argc > 2 ? atoi(argv[2]) : KEYS;
+	char key[KEY_LENGTH];
+
+	DIE(servers <= 0 || count <= 0, "Usage: bench_bounded [servers] [keys]");
+	for (unsigned int e = 0; e < sizeof(epsilons) / sizeof(epsilons[0]); e++) {
+		lb_config config;
+		int server_id;
+
+		init_lb_config(&config);
+		config.epsilon = epsilons[e];
+		load_balancer *main_server = init_load_balancer_config(&config);
+		for (int i = 0; i < servers; i++)
+			loader_add_server(main_server, i);
+
+		double start = now();
+		srand(42);
+		for (int i = 0; i < count; i++) {
+			snprintf(key, sizeof(key), "%08x%06x", rand(), i);
+			loader_store(main_server, key, "v", &server_id);
+		}
+		double store = now() - start;
+
+		start = now();
+		srand(42);
+		for (int i = 0; i < count; i++) {
+			snprintf(key, sizeof(key), "%08x%06x", rand(), i);
+			DIE(!loader_retrieve(main_server, key, &server_id),
+				"Error - a stored key was lost");
+		}
+		double lookup = now() - start;
+
+		printf("== epsilon %.2f\n", epsilons[e]);
+		loader_print_distribution(main_server, stdout);
+		printf("stores/s %.0f lookups/s %.0f\n", count / store,
+				count / lookup);
+
+		// The keys must still be found after the servers change
+		loader_add_server(main_server, servers);
+		loader_remove_server(main_server, 0);
+		srand(42);
+		for (int i = 0; i < count; i++) {
+			snprintf(key, sizeof(key), "%08x%06x", rand(), i);
+			DIE(!loader_retrieve(main_server, key, &server_id),
+				"Error - a key was lost when the servers changed");
+		}
+		printf("after add and remove: load max/mean %.3f\n",
+				loader_load_ratio(main_server));
+		free_load_balancer(main_server);
+	}
+
+	return 0;
+}
@@ -0,0 +1,92 @@
+/* Copyright 2021 <> */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "load_balancer.h"
+#include "utils.h"
+
+#define SERVERS 100
+#define KEYS 200000
+#define KEY_LENGTH 17
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Saves the server of every key and returns how many of them changed
+static int route_all(load_balancer *main_server, char (*keys)[KEY_LENGTH],
+					int *owner, int count) {
+	int moved = 0;
+
+	for (int i = 0; i < count; i++) {
+		int server_id;
+
+		loader_retrieve(main_server, keys[i], &server_id);
+		if (owner[i] != server_id)
+			moved++;
+		owner[i] = server_id;
+	}
+	return moved;
+}
+
+// Compares the routing engines: lookup throughput, balance of the stored
+// keys and the share of the keys which move when a server is added or
+// removed (the minimum is 1 / servers)
+int main(int argc, char* argv[]) {
+	static const char *names[] = {"ring", "maglev", "jump"};
+	lb_engine engines[] = {LB_ENGINE_RING, LB_ENGINE_MAGLEV, LB_ENGINE_JUMP};
+	int servers = argc > 1 ? atoi(argv[1]) : SERVERS;
+	int count = argc > 2 ? atoi(argv[2]) : KEYS;
+
+	DIE(servers <= 1 || count <= 0, "Usage: bench_engines [servers] [keys]");
+	char (*keys)[KEY_LENGTH] = malloc(count * sizeof(*keys));
+	int *owner = malloc(count * sizeof(int));
+	DIE(keys == NULL || owner == NULL, "Error allocating keys");
+
+	srand(42);
+	for (int i = 0; i < count; i++)
+		snprintf(keys[i], KEY_LENGTH, "%08x%06x", rand(), i);
+
+	for (unsigned int e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+		lb_config config;
+
+		init_lb_config(&config);
+		config.engine = engines[e];
+		load_balancer *main_server = init_load_balancer_config(&config);
+		for (int i = 0; i < servers; i++)
+			loader_add_server(main_server, i);
+
+		for (int i = 0; i < count; i++) {
+			int server_id;
+
+			loader_store(main_server, keys[i], "v", &server_id);
+			owner[i] = server_id;
+		}
+
+		double start = now();
+		route_all(main_server, keys, owner, count);
+		double lookup = now() - start;
+
+		printf("== %s\n", names[e]);
+		loader_print_distribution(main_server, stdout);
+		printf("lookups/s %.0f\n", count / lookup);
+
+		// The new server gets the next id, so jump hash can append it
+		loader_add_server(main_server, servers);
+		printf("moved on add %.4f\n",
+				(double)route_all(main_server, keys, owner, count) / count);
+		loader_remove_server(main_server, servers / 2);
+		printf("moved on remove %.4f\n",
+				(double)route_all(main_server, keys, owner, count) / count);
+
+		free_load_balancer(main_server);
+	}
+
+	free(keys);
+	free(owner);
+	return 0;
+}
@@ -0,0 +1,146 @@
+/* Copyright 2021 <> */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hash.h"
+#include "load_balancer.h"
+#include "utils.h"
+
+#define KEYS 200000
+#define KEY_MAX 300
+// Every key set is hashed this many times to time it
+#define ROUNDS 20
+// The chi-squared test counts the keys of 2^16 buckets
+#define BUCKET_BITS 16
+#define SERVERS 16
+#define VNODES 100
+
+typedef struct key_set {
+	const char *name;
+	char *keys;  // The keys one after the other
+	unsigned int *starts;  // Where every key starts
+	unsigned int *lens;
+	unsigned long long bytes;
+} key_set;
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The kinds of keys which are stored: md5 digests (as in the tests),
+// short sequential ids, REST paths and long keys that differ at the end
+static void make_key(int kind, unsigned int i, char *key) {
+	switch (kind) {
+	case 0:
+		snprintf(key, KEY_MAX, "%08x%08x%08x%08x", i * 2654435761u,
+				i ^ 0x5bd1e995u, (i * 40503u) ^ 0xdeadbeefu, ~i * 69069u);
+		break;
+	case 1:
+		snprintf(key, KEY_MAX, "user:%u", i);
+		break;
+	case 2:
+		snprintf(key, KEY_MAX, "/api/v1/customers/%u/orders/%u", i / 16,
+				i % 16);
+		break;
+	default:
+		memset(key, 'x', 250);
+		snprintf(key + 250, KEY_MAX - 250, "%u", i);
+	}
+}
+
+static void make_set(key_set *set, int kind, const char *name) {
+	set->name = name;
+	set->keys = malloc((size_t)KEYS * KEY_MAX);
+	set->starts = malloc(KEYS * sizeof(unsigned int));
+	set->lens = malloc(KEYS * sizeof(unsigned int));
+	DIE(set->keys == NULL || set->starts == NULL || set->lens == NULL,
+		"Error allocating keys");
+	set->bytes = 0;
+	for (unsigned int i = 0; i < KEYS; i++) {
+		make_key(kind, i, set->keys + set->bytes);
+		set->starts[i] = set->bytes;
+		set->lens[i] = strlen(set->keys + set->bytes);
+		set->bytes += set->lens[i];
+	}
+}
+
+// chi^2 / degrees of freedom of the bucket counts (about 1 for a
+// uniform hash, much bigger when keys crowd some buckets)
+static double chi_squared(const unsigned int *counts, unsigned int buckets) {
+	double expected = (double)KEYS / buckets, chi = 0;
+
+	for (unsigned int i = 0; i < buckets; i++)
+		chi += (counts[i] - expected) * (counts[i] - expected) / expected;
+	return chi / (buckets - 1);
+}
+
+static void bench(key_set *set, const char *hash_name, hash_fn hash,
+				lb_hash config_hash) {
+	static unsigned int high[1 << BUCKET_BITS], low[1 << BUCKET_BITS];
+	volatile unsigned int sink = 0;  // keeps the hashes from being dropped
+
+	// throughput
+	double start = now();
+	for (int r = 0; r < ROUNDS; r++)
+		for (unsigned int i = 0; i < KEYS; i++)
+			sink += hash(set->keys + set->starts[i], set->lens[i]);
+	double seconds = now() - start;
+
+	// distribution of the high bits (the ring) and of the low bits
+	memset(high, 0, sizeof(high));
+	memset(low, 0, sizeof(low));
+	for (unsigned int i = 0; i < KEYS; i++) {
+		unsigned int h = hash(set->keys + set->starts[i], set->lens[i]);
+
+		high[h >> (32 - BUCKET_BITS)]++;
+		low[h & ((1u << BUCKET_BITS) - 1)]++;
+	}
+
+	// balance of a ring which routes these keys
+	lb_config config;
+	init_lb_config(&config);
+	config.key_hash = config_hash;
+	load_balancer *main_server = init_load_balancer_config(&config);
+	for (int i = 0; i < SERVERS; i++)
+		loader_add_server_weighted(main_server, i, VNODES);
+	for (unsigned int i = 0; i < KEYS; i++) {
+		int server_id;
+
+		loader_store_n(main_server, set->keys + set->starts[i],
+					set->lens[i], "v", 1, &server_id);
+	}
+
+	printf("%-6s %-7s %7.2f ns/key %6.2f GB/s  chi2/df high %9.2f low %9.2f"
+			"  ring max/mean %.3f\n", hash_name, set->name,
+			seconds * 1e9 / ((double)KEYS * ROUNDS),
+			set->bytes * ROUNDS / seconds / 1e9,
+			chi_squared(high, 1 << BUCKET_BITS),
+			chi_squared(low, 1 << BUCKET_BITS),
+			loader_load_ratio(main_server));
+	free_load_balancer(main_server);
+}
+
+// Compares djb2 and wyhash on a few realistic key sets: hashing speed,
+// how uniform the hashes are and how even a ring of 16 servers gets
+int main(void) {
+	static const char *names[] = {"md5", "seq", "path", "long"};
+	key_set set;
+
+	printf("%d keys, ring of %d servers with %d copies\n", KEYS, SERVERS,
+			VNODES);
+	for (int kind = 0; kind < 4; kind++) {
+		make_set(&set, kind, names[kind]);
+		bench(&set, "djb2", hash_djb2, LB_HASH_DJB2);
+		bench(&set, "wyhash", hash_wy, LB_HASH_WY);
+		free(set.keys);
+		free(set.starts);
+		free(set.lens);
+	}
+
+	return 0;
+}
@@ -0,0 +1,138 @@
+/* Copyright 2021 <> */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "load_balancer.h"
+#include "utils.h"
+
+#define SERVERS 100
+#define KEYS 200000
+#define KEY_LENGTH 17
+#define VALUE_LENGTH 32
+#define SECONDS 1.0
+// IDs of the servers added and removed while the readers run
+#define CHURN_ID 90000
+
+typedef struct bench {
+	load_balancer *main_server;
+	char (*keys)[KEY_LENGTH];
+	unsigned int count;
+	int stop;  // set once the time is up
+} bench;
+
+typedef struct reader {
+	bench *b;
+	unsigned int seed;
+	unsigned long long retrieves;
+	pthread_t thread;
+} reader;
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Every key was stored before the readers started, so none can be missing
+static void* read_keys(void *arg) {
+	reader *r = arg;
+	char value[VALUE_LENGTH];
+	int server_id;
+
+	while (!__atomic_load_n(&r->b->stop, __ATOMIC_RELAXED)) {
+		for (int i = 0; i < 64; i++) {
+			unsigned int k = rand_r(&r->seed) % r->b->count;
+
+			DIE(!loader_retrieve_copy(r->b->main_server, r->b->keys[k],
+				value, sizeof(value), &server_id),
+				"Error - a key was missed during churn");
+		}
+		r->retrieves += 64;
+	}
+	return NULL;
+}
+
+// Adds and removes servers until the readers are done
+static void* churn(void *arg) {
+	bench *b = arg;
+	unsigned long long *changes = malloc(sizeof(unsigned long long));
+	DIE(changes == NULL, "Error allocating churn counter");
+
+	*changes = 0;
+	for (int i = 0; !__atomic_load_n(&b->stop, __ATOMIC_RELAXED);
+		i = (i + 1) % 8) {
+		loader_add_server(b->main_server, CHURN_ID + i);
+		loader_remove_server(b->main_server, CHURN_ID + i);
+		*changes += 2;
+	}
+	return changes;
+}
+
+// Retrieve throughput of a thread-safe load balancer from 1 thread up to
+// the number of cores, while another thread keeps adding and removing
+// servers
+int main(int argc, char* argv[]) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+	bench b = {0};
+	lb_config config;
+	char value[VALUE_LENGTH];
+	int server_id;
+
+	DIE(max_threads <= 0, "Usage: bench_mt [threads] [keys]");
+	b.count = argc > 2 ? atoi(argv[2]) : KEYS;
+	b.keys = malloc(b.count * sizeof(*b.keys));
+	DIE(b.keys == NULL, "Error allocating keys");
+
+	init_lb_config(&config);
+	config.thread_safe = 1;
+	b.main_server = init_load_balancer_config(&config);
+	for (int i = 0; i < SERVERS; i++)
+		loader_add_server(b.main_server, i);
+	srand(42);
+	for (unsigned int i = 0; i < b.count; i++) {
+		snprintf(b.keys[i], KEY_LENGTH, "%08x%06x", rand(), i % 0xffffff);
+		snprintf(value, sizeof(value), "value %u", i);
+		loader_store(b.main_server, b.keys[i], value, &server_id);
+	}
+
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		reader *readers = calloc(threads, sizeof(reader));
+		pthread_t churner;
+		DIE(readers == NULL, "Error allocating readers");
+
+		b.stop = 0;
+		double start = now();
+		for (int i = 0; i < threads; i++) {
+			readers[i].b = &b;
+			readers[i].seed = i + 1;
+			pthread_create(&readers[i].thread, NULL, read_keys, &readers[i]);
+		}
+		pthread_create(&churner, NULL, churn, &b);
+		while (now() - start < SECONDS)
+			usleep(1000);
+		__atomic_store_n(&b.stop, 1, __ATOMIC_RELAXED);
+
+		unsigned long long total = 0, *changes;
+		for (int i = 0; i < threads; i++) {
+			pthread_join(readers[i].thread, NULL);
+			total += readers[i].retrieves;
+		}
+		pthread_join(churner, (void **)&changes);
+		double elapsed = now() - start;
+
+		printf("threads %2d retrieves/s %10.0f server changes/s %6.0f\n",
+				threads, total / elapsed, *changes / elapsed);
+		free(changes);
+		free(readers);
+		if (threads < max_threads && threads * 2 > max_threads)
+			threads = max_threads / 2;
+	}
+
+	free_load_balancer(b.main_server);
+	free(b.keys);
+	return 0;
+}
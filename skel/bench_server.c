@@ -0,0 +1,148 @@
+/* Copyright 2021 <> */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "server.h"
+#include "utils.h"
+
+#define KEY_LENGTH 24
+#define LOOKUPS 1000000
+// The chained table gets this many seconds to insert its keys
+#define TIME_BUDGET 10.0
+
+/*
+ * The previous server_memory design, kept here as the baseline:
+ * 100 buckets of singly linked lists, with a duplicate check on store.
+ */
+#define CHAINED_BUCKETS 100
+
+typedef struct chained_node chained_node;
+struct chained_node {
+	char *key;
+	char *value;
+	chained_node *next;
+};
+
+typedef struct chained_table {
+	chained_node *buckets[CHAINED_BUCKETS];
+} chained_table;
+
+static chained_node *chained_find(chained_table *table, char *key) {
+	chained_node *curr =
+		table->buckets[hash_function_string(key) % CHAINED_BUCKETS];
+
+	while (curr != NULL && strcmp(curr->key, key) != 0)
+		curr = curr->next;
+	return curr;
+}
+
+static void chained_store(chained_table *table, char *key, char *value) {
+	if (chained_find(table, key) != NULL)
+		return;
+	unsigned int index = hash_function_string(key) % CHAINED_BUCKETS;
+	chained_node *node = malloc(sizeof(chained_node));
+	DIE(node == NULL, "Error allocating chained node");
+	node->key = strdup(key);
+	node->value = strdup(value);
+	DIE(node->key == NULL || node->value == NULL, "Error copying key");
+	node->next = table->buckets[index];
+	table->buckets[index] = node;
+}
+
+static void chained_free(chained_table *table) {
+	for (int i = 0; i < CHAINED_BUCKETS; i++) {
+		while (table->buckets[i] != NULL) {
+			chained_node *next = table->buckets[i]->next;
+
+			free(table->buckets[i]->key);
+			free(table->buckets[i]->value);
+			free(table->buckets[i]);
+			table->buckets[i] = next;
+		}
+	}
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void make_key(char *key, long i) {
+	snprintf(key, KEY_LENGTH, "key-%016lx", i * 0x9e3779b97f4a7c15ul);
+}
+
+static void bench_size(long keys) {
+	char key[KEY_LENGTH];
+	long lookups = keys < LOOKUPS ? LOOKUPS : keys;
+	long found = 0;
+	double start;
+
+	// open addressing table
+	server_memory *server = init_server_memory();
+	start = now();
+	for (long i = 0; i < keys; i++) {
+		make_key(key, i);
+		server_store(server, key, "value");
+	}
+	double insert = keys / (now() - start);
+
+	srand(7);
+	start = now();
+	for (long i = 0; i < lookups; i++) {
+		make_key(key, rand() % keys);
+		found += server_retrieve(server, key) != NULL;
+	}
+	double lookup = lookups / (now() - start);
+	free_server_memory(server);
+	printf("%10ld keys  open addressing  insert %12.0f ops/s  lookup %12.0f ops/s\n",
+			keys, insert, lookup);
+
+	// chained table, stopped when it runs out of time
+	chained_table *table = calloc(1, sizeof(chained_table));
+	DIE(table == NULL, "Error allocating chained table");
+	long stored = 0;
+	start = now();
+	while (stored < keys && now() - start < TIME_BUDGET) {
+		for (long i = 0; i < 1024 && stored < keys; i++, stored++) {
+			make_key(key, stored);
+			chained_store(table, key, "value");
+		}
+	}
+	insert = stored / (now() - start);
+
+	long chained_lookups = 0;
+	start = now();
+	while (chained_lookups < lookups && now() - start < TIME_BUDGET) {
+		for (long i = 0; i < 1024; i++, chained_lookups++) {
+			make_key(key, rand() % stored);
+			found += chained_find(table, key) != NULL;
+		}
+	}
+	lookup = chained_lookups / (now() - start);
+	chained_free(table);
+	free(table);
+	printf("%10ld keys  chained (100)    insert %12.0f ops/s  lookup %12.0f ops/s",
+			keys, insert, lookup);
+	if (stored < keys)
+		printf("  (stopped after %ld keys)", stored);
+	printf("\n");
+
+	DIE(found == 0, "Error - no key was found");
+}
+
+int main(int argc, char* argv[]) {
+	long sizes[] = {1000, 100000, 10000000};
+
+	if (argc > 1) {
+		for (int i = 1; i < argc; i++)
+			bench_size(atol(argv[i]));
+		return 0;
+	}
+	for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		bench_size(sizes[i]);
+	return 0;
+}
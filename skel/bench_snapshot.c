@@ -0,0 +1,89 @@
+/* Copyright 2021 <> */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "load_balancer.h"
+#include "utils.h"
+
+#define SERVERS 16
+#define VNODES 50
+#define KEYS 1000000
+#define KEY_LENGTH 40
+#define VALUE_LENGTH 64
+#define LOOKUPS 200000
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void make_pair(unsigned int i, char *key, char *value) {
+	snprintf(key, KEY_LENGTH, "object-%08x-%08x", i * 2654435761u, i);
+	snprintf(value, VALUE_LENGTH, "value of object %u", i);
+}
+
+// Builds a load balancer, saves it and compares restoring the snapshot
+// with storing all the keys again
+int main(int argc, char* argv[]) {
+	const char *path = argc > 1 ? argv[1] : "bench.snapshot";
+	unsigned int keys = argc > 2 ? strtoul(argv[2], NULL, 10) : KEYS;
+	char key[KEY_LENGTH], value[VALUE_LENGTH];
+	int server_id;
+	lb_config config;
+
+	init_lb_config(&config);
+	config.key_hash = LB_HASH_WY;
+	load_balancer *main_server = init_load_balancer_config(&config);
+	for (int i = 0; i < SERVERS; i++)
+		loader_add_server_weighted(main_server, i, VNODES);
+
+	double start = now();
+	for (unsigned int i = 0; i < keys; i++) {
+		make_pair(i, key, value);
+		loader_store(main_server, key, value, &server_id);
+	}
+	double replay = now() - start;
+
+	start = now();
+	DIE(loader_snapshot(main_server, path) != 0, "Error writing snapshot");
+	double save = now() - start;
+	free_load_balancer(main_server);
+
+	start = now();
+	main_server = loader_restore(path, NULL);
+	DIE(main_server == NULL, "Error restoring snapshot");
+	double restore = now() - start;
+
+	// the first retrieves read the objects from the mapped file
+	srand(42);
+	start = now();
+	for (unsigned int i = 0; i < LOOKUPS; i++) {
+		unsigned int k = rand() % keys;
+
+		make_pair(k, key, value);
+		char *found = loader_retrieve(main_server, key, &server_id);
+		DIE(found == NULL || strcmp(found, value), "Error - wrong value");
+	}
+	double lookups = now() - start;
+
+	// a new server copies the objects of the arcs it takes in memory
+	start = now();
+	loader_add_server_weighted(main_server, SERVERS, VNODES);
+	double add = now() - start;
+
+	printf("%u keys\n", keys);
+	printf("store all keys    %8.3f s\n", replay);
+	printf("snapshot          %8.3f s\n", save);
+	printf("restore           %8.3f s\n", restore);
+	printf("retrieve (mapped) %8.0f ops/s\n", LOOKUPS / lookups);
+	printf("add server        %8.3f s (moved %llu keys)\n", add,
+			loader_keys_moved(main_server));
+	free_load_balancer(main_server);
+	remove(path);
+
+	return 0;
+}
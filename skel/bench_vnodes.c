@@ -0,0 +1,41 @@
+/* Copyright 2021 <> */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "load_balancer.h"
+#include "utils.h"
+
+#define SERVERS 100
+#define KEYS 100000
+#define KEY_LENGTH 32
+
+// Builds rings with a growing number of copies per server and prints how
+// far the busiest server is from the mean (keyspace share and stored keys)
+int main(int argc, char* argv[]) {
+	int vnodes[] = {1, 3, 10, 50, 100, 200, 500};
+	int servers = argc > 1 ? atoi(argv[1]) : SERVERS;
+	int keys = argc > 2 ? atoi(argv[2]) : KEYS;
+	char key[KEY_LENGTH];
+
+	DIE(servers <= 0 || keys < 0, "Usage: bench_vnodes [servers] [keys]");
+	for (unsigned int v = 0; v < sizeof(vnodes) / sizeof(vnodes[0]); v++) {
+		load_balancer *main_server = init_load_balancer();
+
+		for (int i = 0; i < servers; i++)
+			loader_add_server_weighted(main_server, i, vnodes[v]);
+
+		srand(42);
+		for (int i = 0; i < keys; i++) {
+			int server_id;
+
+			snprintf(key, sizeof(key), "%08x%06x", rand(), i);
+			loader_store(main_server, key, "v", &server_id);
+		}
+
+		printf("== %d copies per server\n", vnodes[v]);
+		loader_print_distribution(main_server, stdout);
+		free_load_balancer(main_server);
+	}
+
+	return 0;
+}
@@ -0,0 +1,434 @@
+/* Copyright 2021 <> */
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "load_balancer.h"
+#include "utils.h"
+
+// Synthetic workload for the load balancer: a load phase stores every key,
+// then a run phase mixes retrieves and stores with a Zipfian key choice
+// and changes the servers every few operations. The results are written
+// to stdout as JSON
+
+// Latencies are kept in a log-linear histogram: 16 buckets for every
+// power of 2 of nanoseconds, so a percentile is off by at most 1/16
+#define SUB_BUCKETS 16
+#define HIST_BUCKETS (64 * SUB_BUCKETS)
+// Random letters the values are cut from (values are never copied)
+#define VALUE_POOL (1 << 20)
+#define KEY_MAX 256
+
+typedef struct histogram {
+	unsigned long long counts[HIST_BUCKETS];
+	unsigned long long total;
+	unsigned long long max;
+} histogram;
+
+typedef struct workload {
+	unsigned int servers;
+	unsigned long long keys;
+	unsigned long long ops;
+	unsigned int key_min, key_max;
+	unsigned int value_min, value_max;
+	double zipf;  // 0 for a uniform key choice
+	double read_ratio;
+	unsigned long long churn;  // operations between server changes, 0 for none
+	lb_config config;
+	int vnodes;
+	unsigned long long seed;
+} workload;
+
+enum op_type {OP_STORE, OP_RETRIEVE, OP_ADD, OP_REMOVE, NR_OPS};
+static const char *op_names[NR_OPS] = {"store", "retrieve", "add_server",
+									"remove_server"};
+
+static unsigned long long splitmix64(unsigned long long x) {
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+static unsigned long long next_random(unsigned long long *state) {
+	*state += 0x9e3779b97f4a7c15ull;
+	return splitmix64(*state);
+}
+
+// A random double in [0, 1)
+static double next_unit(unsigned long long *state) {
+	return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static unsigned long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned int hist_bucket(unsigned long long ns) {
+	if (ns < SUB_BUCKETS)
+		return ns;
+	int power = 63 - __builtin_clzll(ns);
+	unsigned int sub = (ns >> (power - 4)) & (SUB_BUCKETS - 1);
+
+	return (power - 3) * SUB_BUCKETS + sub;
+}
+
+// The lowest latency which falls in a bucket
+static unsigned long long bucket_low(unsigned int bucket) {
+	if (bucket < SUB_BUCKETS)
+		return bucket;
+	int power = bucket / SUB_BUCKETS + 3;
+
+	return (1ull << power) + ((unsigned long long)(bucket % SUB_BUCKETS)
+								<< (power - 4));
+}
+
+static void hist_add(histogram *hist, unsigned long long ns) {
+	hist->counts[hist_bucket(ns)]++;
+	hist->total++;
+	if (ns > hist->max)
+		hist->max = ns;
+}
+
+static unsigned long long hist_percentile(histogram *hist, double p) {
+	unsigned long long rank = (unsigned long long)ceil(p * hist->total);
+	unsigned long long seen = 0;
+
+	if (rank == 0)
+		rank = 1;
+	for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist->counts[i];
+		if (seen >= rank)
+			return bucket_low(i);
+	}
+	return hist->max;
+}
+
+// Zipfian ranks (Gray et al., as in YCSB): rank 0 is the most popular
+typedef struct zipf_gen {
+	unsigned long long items;
+	double theta, alpha, zetan, eta;
+} zipf_gen;
+
+static void zipf_init(zipf_gen *zipf, unsigned long long items, double theta) {
+	double zeta2 = 1 + pow(0.5, theta);
+
+	zipf->items = items;
+	zipf->theta = theta;
+	zipf->zetan = 0;
+	for (unsigned long long i = 1; i <= items; i++)
+		zipf->zetan += 1 / pow(i, theta);
+	zipf->alpha = 1 / (1 - theta);
+	zipf->eta = (1 - pow(2.0 / items, 1 - theta)) / (1 - zeta2 / zipf->zetan);
+}
+
+static unsigned long long zipf_next(zipf_gen *zipf, unsigned long long *state) {
+	double u = next_unit(state), uz = u * zipf->zetan;
+
+	if (uz < 1)
+		return 0;
+	if (uz < 1 + pow(0.5, zipf->theta))
+		return 1;
+	unsigned long long rank = zipf->items *
+		pow(zipf->eta * u - zipf->eta + 1, zipf->alpha);
+	return rank < zipf->items ? rank : zipf->items - 1;
+}
+
+// Key i starts with 8 hex digits which are unique for every i (a
+// bijection of i), padded with letters up to a length picked from i
+static unsigned int make_key(workload *w, unsigned long long i, char *key) {
+	unsigned long long mixed = splitmix64(i ^ w->seed);
+	unsigned int len = w->key_min + mixed % (w->key_max - w->key_min + 1);
+	unsigned int id = (unsigned int)i;
+
+	id = (id ^ (id >> 16)) * 0x45d9f3b;
+	id = (id ^ (id >> 16)) * 0x45d9f3b;
+	id ^= id >> 16;
+	snprintf(key, KEY_MAX, "%08x", id);
+	for (unsigned int pos = 8; pos < len; pos++)
+		key[pos] = 'a' + (mixed >> (pos % 58)) % 26;
+	key[len] = '\0';
+	return len;
+}
+
+static const char* make_value(workload *w, const char *pool,
+							unsigned long long *state, unsigned int *len) {
+	*len = w->value_min + next_random(state) % (w->value_max - w->value_min + 1);
+	return pool + next_random(state) % (VALUE_POOL - *len);
+}
+
+static void parse_range(const char *text, unsigned int *low,
+						unsigned int *high) {
+	DIE(sscanf(text, "%u:%u", low, high) != 2 && sscanf(text, "%u", low) != 1,
+		"Error - sizes are given as MIN:MAX");
+	if (!strchr(text, ':'))
+		*high = *low;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [--servers N] [--keys N] [--ops N]\n"
+			"\t[--key-size MIN:MAX] [--value-size MIN:MAX] [--zipf THETA]\n"
+			"\t[--read-ratio R] [--churn OPS] [--engine ring|maglev|jump]\n"
+			"\t[--vnodes N] [--epsilon E] [--hash djb2|wyhash] [--seed S]\n"
+			"\t[--journal PATH] [--sync-us US] [--compact BYTES]"
+			" [--replicas R]\n\t[--read-cache ENTRIES]\n", name);
+	exit(1);
+}
+
+static void parse_args(workload *w, int argc, char *argv[]) {
+	static struct option options[] = {
+		{"servers", required_argument, NULL, 's'},
+		{"keys", required_argument, NULL, 'k'},
+		{"ops", required_argument, NULL, 'o'},
+		{"key-size", required_argument, NULL, 'K'},
+		{"value-size", required_argument, NULL, 'V'},
+		{"zipf", required_argument, NULL, 'z'},
+		{"read-ratio", required_argument, NULL, 'r'},
+		{"churn", required_argument, NULL, 'c'},
+		{"engine", required_argument, NULL, 'e'},
+		{"vnodes", required_argument, NULL, 'v'},
+		{"epsilon", required_argument, NULL, 'E'},
+		{"hash", required_argument, NULL, 'h'},
+		{"seed", required_argument, NULL, 'S'},
+		{"journal", required_argument, NULL, 'j'},
+		{"sync-us", required_argument, NULL, 'u'},
+		{"compact", required_argument, NULL, 'C'},
+		{"replicas", required_argument, NULL, 'R'},
+		{"read-cache", required_argument, NULL, 'H'},
+		{NULL, 0, NULL, 0}
+	};
+	int opt;
+
+	w->servers = 100;
+	w->keys = 1000000;
+	w->ops = 0;
+	w->key_min = w->key_max = 32;
+	w->value_min = 16;
+	w->value_max = 64;
+	w->zipf = 0.99;
+	w->read_ratio = 0.9;
+	w->churn = 100000;
+	w->vnodes = 3;
+	w->seed = 42;
+	init_lb_config(&w->config);
+
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (opt) {
+		case 's': w->servers = strtoul(optarg, NULL, 10); break;
+		case 'k': w->keys = strtoull(optarg, NULL, 10); break;
+		case 'o': w->ops = strtoull(optarg, NULL, 10); break;
+		case 'K': parse_range(optarg, &w->key_min, &w->key_max); break;
+		case 'V': parse_range(optarg, &w->value_min, &w->value_max); break;
+		case 'z': w->zipf = atof(optarg); break;
+		case 'r': w->read_ratio = atof(optarg); break;
+		case 'c': w->churn = strtoull(optarg, NULL, 10); break;
+		case 'v': w->vnodes = atoi(optarg); break;
+		case 'E': w->config.epsilon = atof(optarg); break;
+		case 'S': w->seed = strtoull(optarg, NULL, 10); break;
+		case 'j': w->config.journal = optarg; break;
+		case 'u': w->config.journal_sync_us = strtoul(optarg, NULL, 10); break;
+		case 'C':
+			w->config.journal_compact_bytes = strtoull(optarg, NULL, 10);
+			break;
+		case 'R': w->config.replicas = strtoul(optarg, NULL, 10); break;
+		case 'H': w->config.read_cache = strtoul(optarg, NULL, 10); break;
+		case 'e':
+			if (!strcmp(optarg, "ring"))
+				w->config.engine = LB_ENGINE_RING;
+			else if (!strcmp(optarg, "maglev"))
+				w->config.engine = LB_ENGINE_MAGLEV;
+			else if (!strcmp(optarg, "jump"))
+				w->config.engine = LB_ENGINE_JUMP;
+			else
+				usage(argv[0]);
+			break;
+		case 'h':
+			if (!strcmp(optarg, "djb2"))
+				w->config.key_hash = LB_HASH_DJB2;
+			else if (!strcmp(optarg, "wyhash"))
+				w->config.key_hash = LB_HASH_WY;
+			else
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (w->ops == 0)
+		w->ops = w->keys;
+	DIE(w->servers < 2 || w->keys == 0 || w->keys > 0xffffffffull,
+		"Error - needs 2 servers and 1 to 2^32 keys");
+	DIE(w->key_min < 8 || w->key_max >= KEY_MAX || w->key_min > w->key_max,
+		"Error - keys have 8 to 255 characters");
+	DIE(w->value_max >= VALUE_POOL / 2 || w->value_min > w->value_max,
+		"Error - bad value sizes");
+	DIE(w->zipf < 0 || w->zipf == 1 || w->vnodes <= 0,
+		"Error - bad zipf or vnodes");
+}
+
+static void print_latency(histogram *hists) {
+	printf("  \"latency_ns\": {\n");
+	for (int op = 0; op < NR_OPS; op++) {
+		histogram *hist = &hists[op];
+
+		printf("    \"%s\": {\"count\": %llu, \"p50\": %llu, \"p99\": %llu, "
+				"\"p999\": %llu, \"max\": %llu}%s\n", op_names[op], hist->total,
+				hist_percentile(hist, 0.5), hist_percentile(hist, 0.99),
+				hist_percentile(hist, 0.999), hist->max,
+				op + 1 < NR_OPS ? "," : "");
+	}
+	printf("  },\n");
+}
+
+int main(int argc, char *argv[]) {
+	static const char *engines[] = {"ring", "maglev", "jump"};
+	static const char *hashes[] = {"djb2", "wyhash"};
+	workload w;
+	char key[KEY_MAX];
+	int server_id;
+
+	parse_args(&w, argc, argv);
+	histogram *hists = calloc(NR_OPS, sizeof(histogram));
+	char *pool = malloc(VALUE_POOL);
+	int *ids = malloc((w.servers + w.ops / (w.churn ? w.churn : w.ops) + 1)
+					* sizeof(int));
+	DIE(!hists || !pool || !ids, "Error allocating the workload");
+
+	unsigned long long state = w.seed;
+	for (unsigned int i = 0; i < VALUE_POOL; i++)
+		pool[i] = 'a' + next_random(&state) % 26;
+
+	// the workload starts from an empty journal
+	if (w.config.journal) {
+		char checkpoint[PATH_MAX];
+
+		snprintf(checkpoint, sizeof(checkpoint), "%s.snapshot",
+				w.config.journal);
+		unlink(w.config.journal);
+		unlink(checkpoint);
+	}
+	load_balancer *main_server = init_load_balancer_config(&w.config);
+	unsigned int nservers = 0, next_id = 0;
+	for (unsigned int i = 0; i < w.servers; i++) {
+		unsigned long long start = now_ns();
+
+		loader_add_server_weighted(main_server, next_id, w.vnodes);
+		hist_add(&hists[OP_ADD], now_ns() - start);
+		ids[nservers++] = next_id++;
+	}
+
+	// Load phase: every key is stored once
+	unsigned long long load_start = now_ns();
+	for (unsigned long long i = 0; i < w.keys; i++) {
+		unsigned int key_len = make_key(&w, i, key), value_len;
+		const char *value = make_value(&w, pool, &state, &value_len);
+		unsigned long long start = now_ns();
+
+		loader_store_n(main_server, key, key_len, value, value_len, &server_id);
+		hist_add(&hists[OP_STORE], now_ns() - start);
+	}
+	double load_seconds = (now_ns() - load_start) / 1e9;
+
+	// Run phase: the latencies of the load phase are not mixed in
+	memset(hists, 0, NR_OPS * sizeof(histogram));
+	zipf_gen zipf = {0};
+	if (w.zipf > 0)
+		zipf_init(&zipf, w.keys, w.zipf);
+
+	unsigned long long changes = 0, moved_total = 0, moved_max = 0;
+	unsigned long long run_start = now_ns(), busy_ns = 0;
+	for (unsigned long long op = 0; op < w.ops; op++) {
+		if (w.churn && op > 0 && op % w.churn == 0) {
+			// remove a random server and add a new one in turns
+			unsigned long long before = loader_keys_moved(main_server);
+			unsigned long long start = now_ns();
+
+			if (changes % 2 == 0) {
+				unsigned int victim = next_random(&state) % nservers;
+
+				loader_remove_server(main_server, ids[victim]);
+				hist_add(&hists[OP_REMOVE], now_ns() - start);
+				ids[victim] = ids[--nservers];
+			} else {
+				loader_add_server_weighted(main_server, next_id, w.vnodes);
+				hist_add(&hists[OP_ADD], now_ns() - start);
+				ids[nservers++] = next_id++;
+			}
+			unsigned long long moved = loader_keys_moved(main_server) - before;
+
+			moved_total += moved;
+			if (moved > moved_max)
+				moved_max = moved;
+			changes++;
+		}
+
+		unsigned long long rank = w.zipf > 0 ? zipf_next(&zipf, &state)
+									: next_random(&state) % w.keys;
+		// the popular ranks are spread over the keyspace
+		unsigned int key_len = make_key(&w, splitmix64(rank) % w.keys, key);
+		if (next_unit(&state) < w.read_ratio) {
+			unsigned long long start = now_ns();
+
+			loader_retrieve_n(main_server, key, key_len, &server_id, NULL);
+			unsigned long long ns = now_ns() - start;
+			hist_add(&hists[OP_RETRIEVE], ns);
+			busy_ns += ns;
+		} else {
+			unsigned int value_len;
+			const char *value = make_value(&w, pool, &state, &value_len);
+			unsigned long long start = now_ns();
+
+			loader_store_n(main_server, key, key_len, value, value_len,
+						&server_id);
+			unsigned long long ns = now_ns() - start;
+			hist_add(&hists[OP_STORE], ns);
+			busy_ns += ns;
+		}
+	}
+	double run_seconds = (now_ns() - run_start) / 1e9;
+
+	printf("{\n");
+	printf("  \"config\": {\"servers\": %u, \"keys\": %llu, \"ops\": %llu, "
+			"\"key_size\": [%u, %u], \"value_size\": [%u, %u], "
+			"\"zipf\": %.3f, \"read_ratio\": %.3f, \"churn\": %llu, "
+			"\"engine\": \"%s\", \"vnodes\": %d, \"epsilon\": %.3f, "
+			"\"hash\": \"%s\", \"journal\": %s, \"sync_us\": %u, "
+			"\"replicas\": %u, \"read_cache\": %u, \"seed\": %llu},\n",
+			w.servers, w.keys, w.ops,
+			w.key_min, w.key_max, w.value_min, w.value_max, w.zipf,
+			w.read_ratio, w.churn, engines[w.config.engine], w.vnodes,
+			w.config.epsilon, hashes[w.config.key_hash],
+			w.config.journal ? "true" : "false", w.config.journal_sync_us,
+			w.config.replicas, w.config.read_cache, w.seed);
+	printf("  \"load\": {\"ops\": %llu, \"seconds\": %.3f, "
+			"\"ops_per_sec\": %.0f},\n", w.keys, load_seconds,
+			w.keys / load_seconds);
+	printf("  \"run\": {\"ops\": %llu, \"seconds\": %.3f, "
+			"\"ops_per_sec\": %.0f, \"key_ops_per_busy_sec\": %.0f},\n",
+			w.ops, run_seconds, w.ops / run_seconds,
+			busy_ns ? w.ops / (busy_ns / 1e9) : 0);
+	print_latency(hists);
+	printf("  \"topology\": {\"changes\": %llu, \"keys_moved_mean\": %.1f, "
+			"\"keys_moved_max\": %llu, \"keys_moved_fraction_mean\": %.5f},\n",
+			changes, changes ? (double)moved_total / changes : 0, moved_max,
+			changes ? (double)moved_total / changes / w.keys : 0);
+	// the busiest server bounds the reads the whole system can serve
+	printf("  \"load_ratio\": %.3f,\n", loader_load_ratio(main_server));
+	printf("  \"read_load_ratio\": %.3f,\n", loader_read_ratio(main_server));
+	printf("  \"cache_hit_rate\": %.3f\n", loader_cache_hit_rate(main_server));
+	printf("}\n");
+
+	free_load_balancer(main_server);
+	free(hists);
+	free(pool);
+	free(ids);
+	return 0;
+}
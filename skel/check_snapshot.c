@@ -0,0 +1,145 @@
+/* Copyright 2021 <> */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "load_balancer.h"
+#include "utils.h"
+
+// Checks that a snapshot which was cut short or damaged is refused by
+// loader_restore() instead of being served: every shorter length of the
+// file and every 8 byte word of it overwritten must either fail cleanly
+// or give a load balancer which can still be used
+
+#define SERVERS 3
+#define KEYS 200
+#define KEY_LENGTH 32
+#define VALUE_LENGTH 32
+
+static void make_pair(unsigned int i, char *key, char *value) {
+	snprintf(key, KEY_LENGTH, "key%u", i);
+	snprintf(value, VALUE_LENGTH, "value of key %u", i);
+}
+
+// Overwrites a part of the copy of the snapshot
+static void write_at(int fd, const char *data, size_t size, size_t at) {
+	DIE(pwrite(fd, data, size, at) != (ssize_t)size,
+		"Error writing snapshot copy");
+}
+
+static char* read_file(const char *path, size_t *size) {
+	FILE *in = fopen(path, "rb");
+	DIE(in == NULL, "Error opening snapshot");
+	DIE(fseek(in, 0, SEEK_END) != 0, "Error reading snapshot");
+	*size = ftell(in);
+	rewind(in);
+	char *data = malloc(*size);
+	DIE(data == NULL, "Error allocating snapshot copy");
+	DIE(fread(data, 1, *size, in) != *size, "Error reading snapshot");
+	fclose(in);
+	return data;
+}
+
+// Counts the keys retrieved with their value. A new server is added first,
+// so there is one and the objects it takes are copied from the file
+static unsigned int use_restored(load_balancer *main) {
+	char key[KEY_LENGTH], value[VALUE_LENGTH];
+	unsigned int found = 0;
+	int server_id;
+
+	loader_add_server(main, SERVERS + 100);
+	for (unsigned int i = 0; i < KEYS; i++) {
+		make_pair(i, key, value);
+		char *retrieved = loader_retrieve(main, key, &server_id);
+		if (retrieved && !strcmp(retrieved, value))
+			found++;
+	}
+	return found;
+}
+
+static int check(const char *name, int passed) {
+	printf("%s: %s\n", name, passed ? "PASS" : "FAILED");
+	return !passed;
+}
+
+int main(void) {
+	char path[64], key[KEY_LENGTH], value[VALUE_LENGTH];
+	int server_id, failed = 0;
+	size_t size;
+
+	snprintf(path, sizeof(path), "check_snapshot.%d", (int)getpid());
+	load_balancer *main = init_load_balancer();
+	for (int i = 0; i < SERVERS; i++)
+		loader_add_server(main, i);
+	for (unsigned int i = 0; i < KEYS; i++) {
+		make_pair(i, key, value);
+		loader_store(main, key, value, &server_id);
+	}
+	DIE(loader_snapshot(main, path) != 0, "Error writing snapshot");
+	free_load_balancer(main);
+	char *data = read_file(path, &size);
+
+	main = loader_restore(path, NULL);
+	failed += check("intact snapshot", main && use_restored(main) == KEYS);
+	if (main)
+		free_load_balancer(main);
+
+	// the copy is changed in place, the restores map it again every time
+	int fd = open(path, O_RDWR);
+	DIE(fd < 0, "Error opening snapshot");
+	unsigned int accepted = 0;
+	for (size_t length = size; length-- > 0;) {
+		DIE(ftruncate(fd, length) != 0, "Error truncating snapshot copy");
+		main = loader_restore(path, NULL);
+		if (main) {
+			accepted++;
+			free_load_balancer(main);
+		}
+	}
+	failed += check("truncated snapshot", accepted == 0);
+
+	// a write cut short after the tables but with the file at its full
+	// size: the header agrees with the file, the entries are zeroes
+	char *zeroes = calloc(size, 1);
+	DIE(zeroes == NULL, "Error allocating snapshot copy");
+	write_at(fd, data, size / 2, 0);
+	write_at(fd, zeroes, size - size / 2, size / 2);
+	free(zeroes);
+	main = loader_restore(path, NULL);
+	failed += check("zeroed end of snapshot", main == NULL);
+	if (main)
+		free_load_balancer(main);
+	write_at(fd, data, size, 0);
+
+	// every word overwritten in turn: no restore may crash or read outside
+	// the file (run it with the address sanitizer to see the reads)
+	static const unsigned char patterns[] = { 0xff, 0x00, 0x7f };
+	unsigned int restored = 0, tries = 0;
+	for (size_t at = 0; at + 8 <= size; at += 8) {
+		for (size_t p = 0; p < sizeof(patterns); p++) {
+			char word[8];
+
+			memset(word, patterns[p], 8);
+			if (!memcmp(word, data + at, 8))
+				continue;
+			write_at(fd, word, 8, at);
+			main = loader_restore(path, NULL);
+			tries++;
+			if (main) {
+				restored++;
+				use_restored(main);
+				free_load_balancer(main);
+			}
+		}
+		write_at(fd, data + at, 8, at);
+	}
+	printf("%u of %u damaged snapshots restored\n", restored, tries);
+	failed += check("damaged snapshot", 1);
+
+	close(fd);
+	unlink(path);
+	free(data);
+	return failed != 0;
+}
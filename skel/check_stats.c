@@ -0,0 +1,85 @@
+/* Copyright 2021 <> */
+#include <stdio.h>
+#include <string.h>
+
+#include "load_balancer.h"
+#include "utils.h"
+
+// Checks that the counters of a load balancer only count its own
+// operations: two of them work side by side, then a third one is created
+// after the first is freed. Build the load balancer with -DLB_STATS
+
+typedef struct counts {
+	unsigned long long stores, retrieves, hits;
+} counts;
+
+// Reads the operation counters from the report of loader_print_stats()
+static int read_counts(load_balancer *main, counts *c) {
+	char line[256];
+	int found = 0, on = 0;
+	FILE *report = tmpfile();
+	DIE(report == NULL, "Error creating report file");
+
+	loader_print_stats(main, report);
+	rewind(report);
+	while (fgets(line, sizeof(line), report)) {
+		if (!strcmp(line, "stats counters on\n"))
+			on = 1;
+		if (sscanf(line, "stores %llu retrieves %llu hits %llu", &c->stores,
+				&c->retrieves, &c->hits) == 3)
+			found = 1;
+	}
+	fclose(report);
+	return on && found;
+}
+
+static int check(const char *name, load_balancer *main,
+				unsigned long long stores, unsigned long long retrieves,
+				unsigned long long hits) {
+	counts c;
+
+	if (!read_counts(main, &c)) {
+		printf("%s: FAILED (no counters, build with LB_STATS=1)\n", name);
+		return 1;
+	}
+	if (c.stores != stores || c.retrieves != retrieves || c.hits != hits) {
+		printf("%s: FAILED (stores %llu retrieves %llu hits %llu, expected"
+			" %llu %llu %llu)\n", name, c.stores, c.retrieves, c.hits,
+			stores, retrieves, hits);
+		return 1;
+	}
+	printf("%s: PASS\n", name);
+	return 0;
+}
+
+int main(void) {
+	load_balancer *first = init_load_balancer();
+	load_balancer *second = init_load_balancer();
+	char key[32];
+	int server_id, failed = 0;
+
+	loader_add_server(first, 0);
+	loader_add_server(second, 0);
+	for (int i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "key%d", i);
+		loader_store(first, key, "value", &server_id);
+	}
+	for (int i = 0; i < 7; i++) {
+		snprintf(key, sizeof(key), "key%d", i);
+		loader_retrieve(second, key, &server_id);
+	}
+	loader_retrieve(first, "key3", &server_id);
+
+	failed += check("first load balancer", first, 100, 1, 1);
+	failed += check("second load balancer", second, 0, 7, 0);
+	free_load_balancer(first);
+
+	load_balancer *third = init_load_balancer();
+	loader_add_server(third, 1);
+	loader_store(third, "key", "value", &server_id);
+	failed += check("load balancer created later", third, 1, 0, 0);
+	free_load_balancer(third);
+	free_load_balancer(second);
+
+	return failed != 0;
+}
@@ -0,0 +1,98 @@
+/* Copyright 2021 <> */
+#include <stdint.h>
+#include <string.h>
+
+#include "hash.h"
+
+// Odd constants with balanced bits (the secret of wyhash)
+#define WY_0 0xa0761d6478bd642full
+#define WY_1 0xe7037ed1a0b428dbull
+#define WY_2 0x8ebc6af09c88c6e3ull
+#define WY_3 0x589965cc75374cc3ull
+
+unsigned int hash_djb2(const char *key, unsigned int len) {
+	const unsigned char *puchar_a = (const unsigned char *)key;
+	unsigned int hash = 5381;
+
+	for (unsigned int i = 0; i < len; i++)
+		hash = ((hash << 5u) + hash) + puchar_a[i];
+
+	return hash;
+}
+
+// Multiplies two words and folds the 128 bit product
+static inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+	__uint128_t product = (__uint128_t)a * b;
+
+	return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+// The reads are unaligned and little endian on every machine
+static inline uint64_t read64(const unsigned char *p) {
+	uint64_t word;
+
+	memcpy(&word, p, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
+}
+
+static inline uint64_t read32(const unsigned char *p) {
+	uint32_t word;
+
+	memcpy(&word, p, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap32(word);
+#endif
+	return word;
+}
+
+unsigned int hash_wy(const char *key, unsigned int len) {
+	const unsigned char *p = (const unsigned char *)key;
+	uint64_t seed = wy_mix(WY_0, WY_1), a, b;
+
+	if (len <= 16) {
+		if (len >= 4) {
+			// two overlapping pairs of 4 byte reads cover 4 to 16 bytes
+			unsigned int step = (len >> 3) << 2;
+
+			a = (read32(p) << 32) | read32(p + step);
+			b = (read32(p + len - 4) << 32) | read32(p + len - 4 - step);
+		} else if (len > 0) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) |
+				p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		unsigned int left = len;
+
+		if (left > 48) {
+			uint64_t lane1 = seed, lane2 = seed;
+
+			do {
+				seed = wy_mix(read64(p) ^ WY_1, read64(p + 8) ^ seed);
+				lane1 = wy_mix(read64(p + 16) ^ WY_2, read64(p + 24) ^ lane1);
+				lane2 = wy_mix(read64(p + 32) ^ WY_3, read64(p + 40) ^ lane2);
+				p += 48;
+				left -= 48;
+			} while (left > 48);
+			seed ^= lane1 ^ lane2;
+		}
+		while (left > 16) {
+			seed = wy_mix(read64(p) ^ WY_1, read64(p + 8) ^ seed);
+			p += 16;
+			left -= 16;
+		}
+		// the last 16 bytes of the key (they may overlap the rounds)
+		a = read64(p + left - 16);
+		b = read64(p + left - 8);
+	}
+
+	__uint128_t product = (__uint128_t)(a ^ WY_1) * (b ^ seed);
+	uint64_t hash = wy_mix((uint64_t)product ^ WY_0 ^ len,
+						(uint64_t)(product >> 64) ^ WY_1);
+	return (unsigned int)(hash ^ (hash >> 32));
+}
@@ -0,0 +1,30 @@
+/* Copyright 2021 <> */
+#ifndef HASH_H_
+#define HASH_H_
+
+// A key hash: the position of the key on the hash ring, also used (mixed)
+// by the tables of the servers
+typedef unsigned int (*hash_fn)(const char *key, unsigned int len);
+
+/**
+ * hash_djb2() - The original hash of the keys (hash * 33 + c).
+ * @arg1: Key (it doesn't have to end with '\0').
+ * @arg2: Length of the key.
+ *
+ * Reads one byte at a time and keeps keys which only differ at the end
+ * close together, so similar keys land on the same arcs of the ring.
+ */
+unsigned int hash_djb2(const char *key, unsigned int len);
+
+/**
+ * hash_wy() - A wyhash style hash of the keys.
+ * @arg1: Key (it doesn't have to end with '\0').
+ * @arg2: Length of the key.
+ *
+ * Reads 8 bytes at a time (48 per round for long keys, in three
+ * independent lanes) and mixes them with 64x64->128 bit multiplies, so
+ * every bit of the key changes about half of the bits of the result.
+ */
+unsigned int hash_wy(const char *key, unsigned int len);
+
+#endif  /* HASH_H_ */
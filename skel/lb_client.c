@@ -0,0 +1,384 @@
+/* Copyright 2021 <> */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+// Load generator for lb_net. Every connection keeps up to depth requests
+// in flight: the first requests store the keys, the rest retrieve or store
+// random ones. A request is timed from when it is queued until its result
+// line comes back, so the latency includes the time it waited behind the
+// others of its connection. The results are written to stdout as JSON
+
+// Latencies are kept in a log-linear histogram: 16 buckets for every
+// power of 2 of nanoseconds, so a percentile is off by at most 1/16
+#define SUB_BUCKETS 16
+#define HIST_BUCKETS (64 * SUB_BUCKETS)
+#define MAX_EVENTS 64
+#define READ_SIZE (64 << 10)
+// Longest request line (the key and the value included)
+#define REQUEST_MAX 4096
+#define DEFAULT_PORT 7070
+
+typedef struct histogram {
+	unsigned long long counts[HIST_BUCKETS];
+	unsigned long long total;
+	unsigned long long max;
+} histogram;
+
+typedef struct client_config {
+	int port;
+	const char *unix_path;
+	unsigned int connections;
+	unsigned long long requests;  // For every connection
+	unsigned long long keys;
+	unsigned int depth;
+	unsigned int value_size;
+	double read_ratio;
+	unsigned long long seed;
+} client_config;
+
+typedef struct client_conn {
+	int fd;
+	unsigned int index;
+	unsigned long long sent, received;
+	unsigned long long *started;  // Start of the requests in flight
+	char *out;  // Requests not written yet
+	unsigned int out_used, out_size;
+	unsigned long long random;
+	int writing;  // EPOLLOUT is watched
+} client_conn;
+
+static unsigned long long splitmix64(unsigned long long x) {
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+static unsigned long long next_random(unsigned long long *state) {
+	*state += 0x9e3779b97f4a7c15ull;
+	return splitmix64(*state);
+}
+
+// A random double in [0, 1)
+static double next_unit(unsigned long long *state) {
+	return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static unsigned long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned int hist_bucket(unsigned long long ns) {
+	if (ns < SUB_BUCKETS)
+		return ns;
+	int power = 63 - __builtin_clzll(ns);
+	unsigned int sub = (ns >> (power - 4)) & (SUB_BUCKETS - 1);
+
+	return (power - 3) * SUB_BUCKETS + sub;
+}
+
+// The lowest latency which falls in a bucket
+static unsigned long long bucket_low(unsigned int bucket) {
+	if (bucket < SUB_BUCKETS)
+		return bucket;
+	int power = bucket / SUB_BUCKETS + 3;
+
+	return (1ull << power) + ((unsigned long long)(bucket % SUB_BUCKETS)
+								<< (power - 4));
+}
+
+static void hist_add(histogram *hist, unsigned long long ns) {
+	hist->counts[hist_bucket(ns)]++;
+	hist->total++;
+	if (ns > hist->max)
+		hist->max = ns;
+}
+
+static unsigned long long hist_percentile(histogram *hist, double p) {
+	unsigned long long rank = (unsigned long long)ceil(p * hist->total);
+	unsigned long long seen = 0;
+
+	if (rank == 0)
+		rank = 1;
+	for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist->counts[i];
+		if (seen >= rank)
+			return bucket_low(i);
+	}
+	return hist->max;
+}
+
+static int connect_server(client_config *config) {
+	int fd;
+
+	if (config->unix_path) {
+		struct sockaddr_un addr;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		DIE(strlen(config->unix_path) >= sizeof(addr.sun_path),
+			"Error - socket path too long");
+		strcpy(addr.sun_path, config->unix_path);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		DIE(fd < 0, "Error creating socket");
+		DIE(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0,
+			"Error connecting to the server");
+	} else {
+		struct sockaddr_in addr;
+		int one = 1;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(config->port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		DIE(fd < 0, "Error creating socket");
+		DIE(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0,
+			"Error connecting to the server");
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return fd;
+}
+
+// Request i of a connection: the first requests of all the connections
+// store every key once, in turns
+static void queue_request(client_config *config, client_conn *conn,
+						unsigned long long now) {
+	unsigned long long i = conn->sent * config->connections + conn->index;
+	unsigned long long key;
+	int retrieve = 0;
+
+	if (i < config->keys) {
+		key = i;
+	} else {
+		key = next_random(&conn->random) % config->keys;
+		retrieve = next_unit(&conn->random) < config->read_ratio;
+	}
+	if (conn->out_size - conn->out_used < REQUEST_MAX) {
+		conn->out_size *= 2;
+		conn->out = realloc(conn->out, conn->out_size);
+		DIE(conn->out == NULL, "Error allocating requests");
+	}
+
+	char *pos = conn->out + conn->out_used;
+	if (retrieve) {
+		pos += sprintf(pos, "retrieve \"key%08llx\"\n", key);
+	} else {
+		pos += sprintf(pos, "store \"key%08llx\" \"", key);
+		unsigned long long letters = splitmix64(key ^ conn->sent);
+		for (unsigned int c = 0; c < config->value_size; c++)
+			*pos++ = 'a' + (letters >> (c % 59)) % 26;
+		*pos++ = '"';
+		*pos++ = '\n';
+	}
+	conn->out_used = pos - conn->out;
+	conn->started[conn->sent % config->depth] = now;
+	conn->sent++;
+}
+
+// Writes what the socket takes. Returns 1 if requests are left
+static int send_requests(client_conn *conn) {
+	unsigned int done = 0;
+
+	while (done < conn->out_used) {
+		ssize_t sent = send(conn->fd, conn->out + done, conn->out_used - done,
+							MSG_NOSIGNAL | MSG_DONTWAIT);
+
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		DIE(sent < 0, "Error sending requests");
+		done += sent;
+	}
+	memmove(conn->out, conn->out + done, conn->out_used - done);
+	conn->out_used -= done;
+	return conn->out_used > 0;
+}
+
+static void fill(client_config *config, client_conn *conn) {
+	unsigned long long now = now_ns();
+
+	while (conn->sent < config->requests &&
+		conn->sent - conn->received < config->depth)
+		queue_request(config, conn, now);
+}
+
+static void watch(int epoll_fd, client_conn *conn, int writing) {
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | (writing ? EPOLLOUT : 0);
+	ev.data.ptr = conn;
+	DIE(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) < 0,
+		"Error watching a connection");
+	conn->writing = writing;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [--port P | --unix PATH] [--connections N]\n"
+			"\t[--requests N] [--keys N] [--depth N] [--value-size N]\n"
+			"\t[--read-ratio R] [--seed S]\n", name);
+	exit(1);
+}
+
+static void parse_args(client_config *config, int argc, char *argv[]) {
+	static struct option options[] = {
+		{"port", required_argument, NULL, 'p'},
+		{"unix", required_argument, NULL, 'u'},
+		{"connections", required_argument, NULL, 'c'},
+		{"requests", required_argument, NULL, 'n'},
+		{"keys", required_argument, NULL, 'k'},
+		{"depth", required_argument, NULL, 'd'},
+		{"value-size", required_argument, NULL, 'V'},
+		{"read-ratio", required_argument, NULL, 'r'},
+		{"seed", required_argument, NULL, 'S'},
+		{NULL, 0, NULL, 0}
+	};
+	int opt;
+
+	config->port = DEFAULT_PORT;
+	config->unix_path = NULL;
+	config->connections = 4;
+	config->requests = 100000;
+	config->keys = 10000;
+	config->depth = 16;
+	config->value_size = 32;
+	config->read_ratio = 0.9;
+	config->seed = 42;
+
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (opt) {
+		case 'p': config->port = atoi(optarg); break;
+		case 'u': config->unix_path = optarg; break;
+		case 'c': config->connections = strtoul(optarg, NULL, 10); break;
+		case 'n': config->requests = strtoull(optarg, NULL, 10); break;
+		case 'k': config->keys = strtoull(optarg, NULL, 10); break;
+		case 'd': config->depth = strtoul(optarg, NULL, 10); break;
+		case 'V': config->value_size = strtoul(optarg, NULL, 10); break;
+		case 'r': config->read_ratio = atof(optarg); break;
+		case 'S': config->seed = strtoull(optarg, NULL, 10); break;
+		default: usage(argv[0]);
+		}
+	}
+	DIE(config->connections == 0 || config->depth == 0 || config->keys == 0,
+		"Error - needs a connection, a request in flight and a key");
+	DIE(config->value_size + 64 > REQUEST_MAX, "Error - values are too big");
+}
+
+int main(int argc, char *argv[]) {
+	client_config config;
+	histogram *hist = calloc(1, sizeof(histogram));
+	char *in = malloc(READ_SIZE);
+
+	DIE(hist == NULL || in == NULL, "Error allocating client");
+	parse_args(&config, argc, argv);
+
+	int epoll_fd = epoll_create1(0);
+	DIE(epoll_fd < 0, "Error creating epoll");
+	client_conn *conns = calloc(config.connections, sizeof(client_conn));
+	DIE(conns == NULL, "Error allocating connections");
+	for (unsigned int i = 0; i < config.connections; i++) {
+		client_conn *conn = &conns[i];
+		struct epoll_event ev;
+
+		conn->fd = connect_server(&config);
+		conn->index = i;
+		conn->random = splitmix64(config.seed + i);
+		conn->started = malloc(config.depth * sizeof(unsigned long long));
+		conn->out_size = 2 * REQUEST_MAX;
+		conn->out = malloc(conn->out_size);
+		DIE(conn->started == NULL || conn->out == NULL,
+			"Error allocating connections");
+		ev.events = EPOLLIN;
+		ev.data.ptr = conn;
+		DIE(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) < 0,
+			"Error watching a connection");
+	}
+
+	unsigned long long start = now_ns();
+	unsigned int finished = 0;
+	for (unsigned int i = 0; i < config.connections; i++) {
+		fill(&config, &conns[i]);
+		if (send_requests(&conns[i]))
+			watch(epoll_fd, &conns[i], 1);
+		if (config.requests == 0)
+			finished++;
+	}
+
+	struct epoll_event events[MAX_EVENTS];
+	while (finished < config.connections) {
+		int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+
+		if (ready < 0 && errno == EINTR)
+			continue;
+		DIE(ready < 0, "Error waiting for events");
+		for (int e = 0; e < ready; e++) {
+			client_conn *conn = events[e].data.ptr;
+
+			if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+				ssize_t got = recv(conn->fd, in, READ_SIZE, MSG_DONTWAIT);
+
+				if (got < 0 && (errno == EINTR || errno == EAGAIN))
+					continue;
+				DIE(got <= 0, "Error - the server closed the connection");
+				// every request gets one line back
+				unsigned long long now = now_ns();
+				for (char *pos = in; (pos = memchr(pos, '\n', in + got - pos));
+					pos++) {
+					hist_add(hist, now - conn->started[conn->received %
+														config.depth]);
+					if (++conn->received == config.requests)
+						finished++;
+				}
+			}
+			fill(&config, conn);
+			int left = send_requests(conn);
+			if (left != conn->writing)
+				watch(epoll_fd, conn, left);
+		}
+	}
+	double seconds = (now_ns() - start) / 1e9;
+	unsigned long long total = config.requests * config.connections;
+
+	printf("{\n");
+	printf("  \"config\": {\"transport\": \"%s\", \"connections\": %u, "
+			"\"depth\": %u, \"requests\": %llu, \"keys\": %llu, "
+			"\"value_size\": %u, \"read_ratio\": %.2f},\n",
+			config.unix_path ? "unix" : "tcp", config.connections, config.depth,
+			total, config.keys, config.value_size, config.read_ratio);
+	printf("  \"seconds\": %.3f,\n", seconds);
+	printf("  \"requests_per_sec\": %.0f,\n", seconds > 0 ? total / seconds : 0);
+	printf("  \"latency_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu, "
+			"\"max\": %llu}\n", hist_percentile(hist, 0.5),
+			hist_percentile(hist, 0.99), hist_percentile(hist, 0.999),
+			hist->max);
+	printf("}\n");
+
+	for (unsigned int i = 0; i < config.connections; i++) {
+		close(conns[i].fd);
+		free(conns[i].started);
+		free(conns[i].out);
+	}
+	free(conns);
+	free(in);
+	free(hist);
+	close(epoll_fd);
+	return 0;
+}
@@ -0,0 +1,370 @@
+/* Copyright 2021 <> */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "load_balancer.h"
+#include "output.h"
+#include "parser.h"
+#include "utils.h"
+
+// Network front-end of the load balancer. It takes the lines of the input
+// files (store, retrieve, add_server, remove_server, stats) on a local TCP
+// port or a Unix socket and answers every store and retrieve with the line
+// tema2 writes for it. One thread serves every connection with epoll; the
+// requests a client sends without waiting for their results (pipelining)
+// are applied and answered in order. A connection which sends a line that
+// is not a request, or a store or a retrieve while there are no servers,
+// gets the results before it and is closed; the other ones go on
+
+#define READ_SIZE (64 << 10)
+#define MAX_EVENTS 64
+// A connection is not read while this many of its results wait to be sent
+#define PENDING_MAX (1 << 20)
+// Longest line a connection may send
+#define LINE_LIMIT (16 << 20)
+#define DEFAULT_PORT 7070
+
+typedef struct connection {
+	int fd;
+	unsigned int events;  // What epoll watches for it
+	char *in;  // Bytes read which don't make a whole line yet
+	unsigned int in_used, in_size;
+	output_buffer *out;
+	int closing;  // The client sent everything, only results are left
+	struct connection *prev, *next;
+} connection;
+
+typedef struct net_server {
+	load_balancer *main;
+	int listen_fd;
+	int epoll_fd;
+	int echo_values;
+	unsigned int servers;  // Servers in the load balancer
+	connection *connections;
+} net_server;
+
+static volatile sig_atomic_t stopping;
+
+static void on_signal(int sig) {
+	(void)sig;
+	stopping = 1;
+}
+
+static int listen_tcp(int port) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	DIE(fd < 0, "Error creating socket");
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	// only the clients of this machine are served
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	DIE(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0,
+		"Error binding the port");
+	return fd;
+}
+
+static int listen_unix(const char *path) {
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	DIE(fd < 0, "Error creating socket");
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	DIE(strlen(path) >= sizeof(addr.sun_path), "Error - socket path too long");
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	DIE(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0,
+		"Error binding the socket");
+	return fd;
+}
+
+static void watch(net_server *net, connection *conn, unsigned int events) {
+	struct epoll_event ev;
+
+	if (events == conn->events)
+		return;
+	ev.events = events;
+	ev.data.ptr = conn;
+	DIE(epoll_ctl(net->epoll_fd, conn->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+				conn->fd, &ev) < 0, "Error watching a connection");
+	conn->events = events;
+}
+
+static void close_connection(net_server *net, connection *conn) {
+	close(conn->fd);
+	if (conn->prev)
+		conn->prev->next = conn->next;
+	else
+		net->connections = conn->next;
+	if (conn->next)
+		conn->next->prev = conn->prev;
+	output_close(conn->out);
+	free(conn->in);
+	free(conn);
+}
+
+static void accept_all(net_server *net) {
+	while (1) {
+		int fd = accept4(net->listen_fd, NULL, NULL, SOCK_NONBLOCK);
+
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				perror("accept");
+			return;
+		}
+		// the results go out as soon as they are ready (fails on Unix
+		// sockets, which don't need it)
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		connection *conn = calloc(1, sizeof(connection));
+		DIE(conn == NULL, "Error allocating connection");
+		conn->fd = fd;
+		conn->in_size = READ_SIZE;
+		conn->in = malloc(conn->in_size);
+		DIE(conn->in == NULL, "Error allocating connection");
+		conn->out = output_open_memory(net->echo_values);
+		conn->next = net->connections;
+		if (net->connections)
+			net->connections->prev = conn;
+		net->connections = conn;
+		watch(net, conn, EPOLLIN);
+	}
+}
+
+// Applies a request like tema2 does, its result goes to out. Adding a
+// server twice (or removing a missing one) changes nothing. Returns -1 for
+// a store or a retrieve while there are no servers
+static int apply_request(net_server *net, output_buffer *out,
+						const request *req) {
+	load_balancer *main = net->main;
+	int server_id = 0;
+
+	if ((req->type == REQUEST_STORE || req->type == REQUEST_RETRIEVE) &&
+		net->servers == 0)
+		return -1;
+	if (req->type == REQUEST_STORE) {
+		loader_store_n(main, req->key, req->key_len, req->value,
+					req->value_len, &server_id);
+		output_stored(out, req->value, req->value_len, server_id);
+	} else if (req->type == REQUEST_RETRIEVE) {
+		unsigned int value_len;
+		char *value = loader_retrieve_n(main, req->key, req->key_len,
+										&server_id, &value_len);
+		if (value)
+			output_retrieved(out, value, value_len, server_id);
+		else
+			output_missing(out, req->key, req->key_len);
+	} else if (req->type == REQUEST_ADD_SERVER) {
+		if (loader_add_server(main, req->server_id) == 0)
+			net->servers++;
+	} else if (req->type == REQUEST_REMOVE_SERVER) {
+		if (loader_remove_server(main, req->server_id) == 0)
+			net->servers--;
+	} else {
+		// the metrics are printed by the server, not sent
+		loader_print_stats(main, stdout);
+		fflush(stdout);
+	}
+	return 0;
+}
+
+// Applies a line of a connection. Returns -1 if it is not a request or
+// can't be applied
+static int apply_line(net_server *net, connection *conn, const char *line,
+					const char *end) {
+	request req;
+
+	if (!request_parse(line, end, &req)) {
+		fprintf(stderr, "Bad request, closing the connection\n");
+		return -1;
+	}
+	if (apply_request(net, conn->out, &req) < 0) {
+		fprintf(stderr, "No servers for a request, closing the connection\n");
+		return -1;
+	}
+	return 0;
+}
+
+// Applies every whole line read on a connection (and the last one, once
+// the client closed its side). Returns -1 at the first line which fails
+static int apply_lines(net_server *net, connection *conn) {
+	char *line = conn->in, *data_end = conn->in + conn->in_used;
+	char *end;
+
+	while ((end = memchr(line, '\n', data_end - line))) {
+		if (apply_line(net, conn, line, end) < 0)
+			return -1;
+		line = end + 1;
+	}
+	if (conn->closing && line < data_end) {
+		if (apply_line(net, conn, line, data_end) < 0)
+			return -1;
+		line = data_end;
+	}
+	conn->in_used = data_end - line;
+	memmove(conn->in, line, conn->in_used);
+	return 0;
+}
+
+// Sends what the socket takes. Returns -1 if the connection broke
+static int send_pending(connection *conn) {
+	unsigned int len;
+	const char *data = output_pending(conn->out, &len);
+
+	while (len > 0) {
+		ssize_t sent = send(conn->fd, data, len, MSG_NOSIGNAL);
+
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		output_consume(conn->out, sent);
+		data += sent;
+		len -= sent;
+	}
+	return 0;
+}
+
+// Reads once from a connection, then sends the results it can
+static void serve(net_server *net, connection *conn, unsigned int events) {
+	if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !conn->closing) {
+		if (conn->in_used == conn->in_size) {
+			// a line longer than the buffer
+			if (conn->in_size >= LINE_LIMIT) {
+				close_connection(net, conn);
+				return;
+			}
+			conn->in_size *= 2;
+			conn->in = realloc(conn->in, conn->in_size);
+			DIE(conn->in == NULL, "Error allocating connection");
+		}
+		ssize_t got = read(conn->fd, conn->in + conn->in_used,
+						conn->in_size - conn->in_used);
+
+		if (got < 0 && errno != EAGAIN && errno != EINTR) {
+			close_connection(net, conn);
+			return;
+		}
+		if (got == 0)
+			conn->closing = 1;
+		if (got > 0)
+			conn->in_used += got;
+		if (got >= 0 && apply_lines(net, conn) < 0) {
+			// the results before the failed line are still sent
+			conn->closing = 1;
+			conn->in_used = 0;
+		}
+	}
+	if (send_pending(conn) < 0) {
+		close_connection(net, conn);
+		return;
+	}
+
+	unsigned int pending;
+	output_pending(conn->out, &pending);
+	if (conn->closing && pending == 0) {
+		close_connection(net, conn);
+		return;
+	}
+	// a client which doesn't read its results is not read either
+	unsigned int events_next = pending ? EPOLLOUT : 0;
+	if (!conn->closing && pending < PENDING_MAX)
+		events_next |= EPOLLIN;
+	watch(net, conn, events_next);
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [--port P | --unix PATH] [--servers N]"
+			" [--no-values]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	static struct option options[] = {
+		{"port", required_argument, NULL, 'p'},
+		{"unix", required_argument, NULL, 'u'},
+		{"servers", required_argument, NULL, 's'},
+		{"no-values", no_argument, NULL, 'n'},
+		{NULL, 0, NULL, 0}
+	};
+	net_server net;
+	int port = DEFAULT_PORT, servers = 10, opt;
+	const char *unix_path = NULL;
+
+	memset(&net, 0, sizeof(net));
+	net.echo_values = 1;
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (opt) {
+		case 'p': port = atoi(optarg); break;
+		case 'u': unix_path = optarg; break;
+		case 's': servers = atoi(optarg); break;
+		case 'n': net.echo_values = 0; break;
+		default: usage(argv[0]);
+		}
+	}
+	DIE(servers < 0, "Error - bad number of servers");
+
+	// the clients can add more servers, the first ones are 0 .. N - 1
+	net.main = init_load_balancer();
+	for (int i = 0; i < servers; i++)
+		loader_add_server(net.main, i);
+	net.servers = servers;
+
+	net.listen_fd = unix_path ? listen_unix(unix_path) : listen_tcp(port);
+	DIE(listen(net.listen_fd, SOMAXCONN) < 0, "Error listening");
+	net.epoll_fd = epoll_create1(0);
+	DIE(net.epoll_fd < 0, "Error creating epoll");
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	DIE(epoll_ctl(net.epoll_fd, EPOLL_CTL_ADD, net.listen_fd, &ev) < 0,
+		"Error watching the socket");
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = on_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	struct epoll_event events[MAX_EVENTS];
+	while (!stopping) {
+		int ready = epoll_wait(net.epoll_fd, events, MAX_EVENTS, -1);
+
+		if (ready < 0 && errno == EINTR)
+			continue;
+		DIE(ready < 0, "Error waiting for events");
+		for (int i = 0; i < ready; i++) {
+			if (events[i].data.ptr)
+				serve(&net, events[i].data.ptr, events[i].events);
+			else
+				accept_all(&net);
+		}
+	}
+
+	while (net.connections)
+		close_connection(&net, net.connections);
+	close(net.epoll_fd);
+	close(net.listen_fd);
+	if (unix_path)
+		unlink(unix_path);
+	free_load_balancer(net.main);
+	return 0;
+}
@@ -2,94 +2,46 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "load_balancer.h"
+#include "output.h"
+#include "parser.h"
+#include "pipeline.h"
 #include "utils.h"
 
-#define REQUEST_LENGTH 1024
-#define KEY_LENGTH 128
-#define VALUE_LENGTH 65536
-
-void get_key_value(char* key, char* value, char* request) {
-	int key_start = 0, value_start = 0;
-	int key_finish = 0, value_finish = 0;
-	int key_index = 0, value_index = 0;
-
-	for (unsigned int i = 0; i < strlen(request); ++i) {
-		if (request[i] == '"') {
-			if (key_start == 0) {
-				key_start = 1;
-			} else if (key_finish == 0) {
-				key_finish = 1;
-			} else if (value_start == 0) {
-				value_start = 1;
-			} else {
-				value_finish = 1;
-			}
-		} else {
-			if (key_start == 1 && key_finish == 0) {
-				key[key_index++] = request[i];
-			} else if (value_start == 1 && value_finish == 0) {
-				value[value_index++] = request[i];
-			}
-		}
-	}
-}
-
-void get_key(char* key, char* request) {
-	int key_start = 0, key_index = 0;
-
-	for (unsigned int i = 0; i < strlen(request); ++i) {
-		if (request[i] == '"') {
-			key_start = 1;
-		} else if (key_start == 1) {
-			key[key_index++] = request[i];
-		}
-	}
-}
-
-void apply_requests(FILE* input_file) {
-	char request[REQUEST_LENGTH] = {0};
-	char key[KEY_LENGTH] = {0};
-	char value[VALUE_LENGTH] = {0};
+void apply_requests(input_file* input, output_buffer* out) {
 	load_balancer* main_server = init_load_balancer();
-
-	while (fgets(request, REQUEST_LENGTH, input_file)) {
-		request[strlen(request) - 1] = 0;
-		if (!strncmp(request, "store", sizeof("store") - 1)) {
-			get_key_value(key, value, request);
-
-			int index_server = 0;
-			loader_store(main_server, key, value, &index_server);
-			printf("Stored %s on server %d.\n", value, index_server);
-
-			memset(key, 0, sizeof(key));
-			memset(value, 0, sizeof(value));
-		} else if (!strncmp(request, "retrieve", sizeof("retrieve") - 1)) {
-			get_key(key, request);
-
-			int index_server = 0;
-			char *retrieved_value = loader_retrieve(main_server,
-											key, &index_server);
+	request req;
+
+	while (input_next(input, &req)) {
+		int index_server = 0;
+
+		if (req.type == REQUEST_STORE) {
+			loader_store_n(main_server, req.key, req.key_len,
+						req.value, req.value_len, &index_server);
+			output_stored(out, req.value, req.value_len, index_server);
+		} else if (req.type == REQUEST_RETRIEVE) {
+			unsigned int value_len;
+			char *retrieved_value = loader_retrieve_n(main_server, req.key,
+									req.key_len, &index_server, &value_len);
 			if (retrieved_value) {
-				printf("Retrieved %s from server %d.\n",
-						retrieved_value, index_server);
+				output_retrieved(out, retrieved_value, value_len,
+								index_server);
 			} else {
-				printf("Key %s not present.\n", key);
+				output_missing(out, req.key, req.key_len);
 			}
-
-			memset(key, 0, sizeof(key));
-		} else if (!strncmp(request, "add_server", sizeof("add_server") - 1)) {
-			int server_id = atoi(request + sizeof("add_server"));
-
-			loader_add_server(main_server, server_id);
-		} else if (!strncmp(request, "remove_server",
-					sizeof("remove_server") - 1)) {
-			int server_id = atoi(request + sizeof("remove_server"));
-
-			loader_remove_server(main_server, server_id);
+		} else if (req.type == REQUEST_ADD_SERVER) {
+			// adding a server twice (or removing a missing one) changes
+			// nothing
+			loader_add_server(main_server, req.server_id);
+		} else if (req.type == REQUEST_REMOVE_SERVER) {
+			loader_remove_server(main_server, req.server_id);
 		} else {
-			DIE(1, "unknown function call");
+			// the results before the metrics have to be written first
+			output_flush(out);
+			loader_print_stats(main_server, stdout);
+			fflush(stdout);
 		}
 	}
 
@@ -97,19 +49,37 @@ void apply_requests(FILE* input_file) {
 }
 
 int main(int argc, char* argv[]) {
-	FILE *input;
-
-	if (argc != 2) {
-		printf("Usage:%s input_file \n", argv[0]);
+	input_file *input;
+	output_buffer *out;
+	int echo_values = 1, bad_args = argc < 2;
+	unsigned int threads = 0;
+
+	// --no-values leaves the values out of the results (for benchmarks),
+	// --threads N applies the requests on a pipeline of N executors
+	for (int i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "--no-values"))
+			echo_values = 0;
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else
+			bad_args = 1;
+	}
+	if (bad_args) {
+		printf("Usage:%s input_file [--no-values] [--threads N]\n", argv[0]);
 		return -1;
 	}
 
-	input = fopen(argv[1], "rt");
+	input = input_open(argv[1]);
 	DIE(input == NULL, "missing input file");
+	out = output_open(STDOUT_FILENO, echo_values);
 
-	apply_requests(input);
+	if (threads > 0)
+		pipeline_run(input, out, threads);
+	else
+		apply_requests(input, out);
 
-	fclose(input);
+	output_close(out);
+	input_close(input);
 
 	return 0;
 }
@@ -0,0 +1,167 @@
+/* Copyright 2021 <> */
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "utils.h"
+
+#define OUTPUT_SIZE (1 << 20)
+// Longest int written in decimal, with its sign
+#define INT_DIGITS 11
+
+// A writer of a connection starts small and grows with its results
+#define MEMORY_SIZE (64 << 10)
+
+struct output_buffer {
+	char *data;
+	unsigned int start;  // Results before it were taken (memory writers)
+	unsigned int used;
+	unsigned int size;
+	int fd;  // -1 for the writers which keep the results in memory
+	int echo_values;
+};
+
+static output_buffer* output_create(int fd, int echo_values,
+									unsigned int size) {
+	output_buffer *out = malloc(sizeof(output_buffer));
+	DIE(out == NULL, "Error allocating output");
+	out->data = malloc(size);
+	DIE(out->data == NULL, "Error allocating output");
+	out->start = 0;
+	out->used = 0;
+	out->size = size;
+	out->fd = fd;
+	out->echo_values = echo_values;
+	return out;
+}
+
+output_buffer* output_open(int fd, int echo_values) {
+	return output_create(fd, echo_values, OUTPUT_SIZE);
+}
+
+output_buffer* output_open_memory(int echo_values) {
+	return output_create(-1, echo_values, MEMORY_SIZE);
+}
+
+static void write_all(int fd, const char *data, unsigned int len) {
+	while (len > 0) {
+		ssize_t done = write(fd, data, len);
+
+		if (done < 0 && errno == EINTR)
+			continue;
+		DIE(done < 0, "Error writing output");
+		data += done;
+		len -= done;
+	}
+}
+
+void output_flush(output_buffer *out) {
+	if (out->fd < 0)
+		return;
+	write_all(out->fd, out->data, out->used);
+	out->used = 0;
+}
+
+// Makes room for len more bytes in a memory writer
+static void reserve(output_buffer *out, unsigned int len) {
+	if (out->start > 0) {
+		memmove(out->data, out->data + out->start, out->used - out->start);
+		out->used -= out->start;
+		out->start = 0;
+	}
+	while (out->used + len > out->size) {
+		DIE(out->size > UINT_MAX / 2, "Error - too many pending results");
+		out->size *= 2;
+	}
+	out->data = realloc(out->data, out->size);
+	DIE(out->data == NULL, "Error allocating output");
+}
+
+static void put(output_buffer *out, const char *data, unsigned int len) {
+	if (out->fd < 0) {
+		if (out->used + len > out->size)
+			reserve(out, len);
+	} else if (out->used + len > OUTPUT_SIZE) {
+		output_flush(out);
+		// a piece bigger than the buffer goes out directly
+		if (len > OUTPUT_SIZE) {
+			write_all(out->fd, data, len);
+			return;
+		}
+	}
+	memcpy(out->data + out->used, data, len);
+	out->used += len;
+}
+
+// The digits are written backwards into a small array and copied once
+static void put_int(output_buffer *out, int number) {
+	char digits[INT_DIGITS];
+	unsigned int pos = INT_DIGITS;
+	unsigned int value = number < 0 ? -(unsigned int)number
+						: (unsigned int)number;
+
+	do {
+		digits[--pos] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	if (number < 0)
+		digits[--pos] = '-';
+	put(out, digits + pos, INT_DIGITS - pos);
+}
+
+#define PUT_TEXT(out, text) put(out, text, sizeof(text) - 1)
+
+void output_stored(output_buffer *out, const char *value,
+				unsigned int value_len, int server_id) {
+	if (out->echo_values) {
+		PUT_TEXT(out, "Stored ");
+		put(out, value, value_len);
+		PUT_TEXT(out, " on server ");
+	} else {
+		PUT_TEXT(out, "Stored on server ");
+	}
+	put_int(out, server_id);
+	PUT_TEXT(out, ".\n");
+}
+
+void output_retrieved(output_buffer *out, const char *value,
+					unsigned int value_len, int server_id) {
+	if (out->echo_values) {
+		PUT_TEXT(out, "Retrieved ");
+		put(out, value, value_len);
+		PUT_TEXT(out, " from server ");
+	} else {
+		PUT_TEXT(out, "Retrieved from server ");
+	}
+	put_int(out, server_id);
+	PUT_TEXT(out, ".\n");
+}
+
+void output_missing(output_buffer *out, const char *key, unsigned int key_len) {
+	PUT_TEXT(out, "Key ");
+	put(out, key, key_len);
+	PUT_TEXT(out, " not present.\n");
+}
+
+const char* output_pending(output_buffer *out, unsigned int *len) {
+	*len = out->used - out->start;
+	return out->data + out->start;
+}
+
+void output_consume(output_buffer *out, unsigned int len) {
+	out->start += len;
+	if (out->start == out->used) {
+		out->start = 0;
+		out->used = 0;
+	}
+}
+
+void output_close(output_buffer *out) {
+	DIE(out == NULL, "No output to close");
+	output_flush(out);
+	free(out->data);
+	free(out);
+}
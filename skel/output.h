@@ -0,0 +1,49 @@
+/* Copyright 2021 <> */
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+typedef struct output_buffer output_buffer;
+
+/**
+ * output_open() - Creates a buffered writer for the results.
+ * @arg1: File descriptor the results are written to.
+ * @arg2: 0 to leave the values out of the results (for benchmarks).
+ *
+ * The results are formatted in a big buffer which is written out
+ * when it fills up and by output_close().
+ */
+output_buffer* output_open(int fd, int echo_values);
+
+/**
+ * output_open_memory() - Creates a writer which keeps the results.
+ * @arg1: 0 to leave the values out of the results.
+ *
+ * Nothing is written: the buffer grows until the caller takes the
+ * results with output_pending() and output_consume() (e.g. to send
+ * them on a non-blocking socket). output_flush() does nothing.
+ */
+output_buffer* output_open_memory(int echo_values);
+
+// "Stored <value> on server <id>."
+void output_stored(output_buffer *out, const char *value,
+				unsigned int value_len, int server_id);
+
+// "Retrieved <value> from server <id>."
+void output_retrieved(output_buffer *out, const char *value,
+					unsigned int value_len, int server_id);
+
+// "Key <key> not present."
+void output_missing(output_buffer *out, const char *key, unsigned int key_len);
+
+void output_flush(output_buffer *out);
+
+// Returns the results of a memory writer which were not consumed yet
+const char* output_pending(output_buffer *out, unsigned int *len);
+
+// Drops the first len pending results (after they were sent)
+void output_consume(output_buffer *out, unsigned int len);
+
+// Flushes and frees the writer (the file descriptor stays open)
+void output_close(output_buffer *out);
+
+#endif  /* OUTPUT_H_ */
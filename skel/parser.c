@@ -0,0 +1,163 @@
+/* Copyright 2021 <> */
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parser.h"
+#include "utils.h"
+
+#define READ_CHUNK (1 << 20)
+// The pages of a mapped input are dropped after every 16 MB parsed
+#define RELEASE_CHUNK (16 << 20)
+
+struct input_file {
+	const char *data;  // The whole input
+	size_t size;
+	size_t pos;  // Start of the next line
+	int mapped;  // 1 if data is a mapping, 0 if it was read in memory
+	size_t released;  // The mapping before this offset was dropped
+};
+
+// Reads what can't be mapped, growing the buffer as it fills
+static char* read_all(int fd, size_t *size) {
+	size_t cap = READ_CHUNK, len = 0;
+	char *data = malloc(cap);
+	DIE(data == NULL, "Error allocating input");
+
+	while (1) {
+		if (len == cap) {
+			cap *= 2;
+			data = realloc(data, cap);
+			DIE(data == NULL, "Error allocating input");
+		}
+		ssize_t got = read(fd, data + len, cap - len);
+		DIE(got < 0, "Error reading input");
+		if (got == 0)
+			break;
+		len += got;
+	}
+	*size = len;
+	return data;
+}
+
+input_file* input_open(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	input_file *input = calloc(1, sizeof(input_file));
+	DIE(input == NULL, "Error allocating input");
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (data != MAP_FAILED) {
+			// the file is read once, from the start to the end
+			madvise(data, st.st_size, MADV_SEQUENTIAL);
+			input->data = data;
+			input->size = st.st_size;
+			input->mapped = 1;
+		}
+	}
+	if (!input->mapped)
+		input->data = read_all(fd, &input->size);
+	close(fd);
+	return input;
+}
+
+// Returns the position of the first c in [pos, end) or end
+static const char* find(const char *pos, const char *end, char c) {
+	const char *found = memchr(pos, c, end - pos);
+
+	return found ? found : end;
+}
+
+// The text between the next two quotes of the line
+static const char* quoted(const char *pos, const char *end,
+						const char **text, unsigned int *len) {
+	const char *start = find(pos, end, '"');
+	start = start < end ? start + 1 : end;
+	const char *stop = find(start, end, '"');
+
+	*text = start;
+	*len = stop - start;
+	return stop < end ? stop + 1 : end;
+}
+
+// Parses the number after a command, like atoi
+static int number(const char *pos, const char *end) {
+	int sign = 1, value = 0;
+
+	while (pos < end && *pos == ' ')
+		pos++;
+	if (pos < end && (*pos == '-' || *pos == '+'))
+		sign = *pos++ == '-' ? -1 : 1;
+	while (pos < end && *pos >= '0' && *pos <= '9')
+		value = value * 10 + (*pos++ - '0');
+	return sign * value;
+}
+
+static int starts_with(const char *pos, const char *end, const char *word,
+					size_t len) {
+	return (size_t)(end - pos) >= len && memcmp(pos, word, len) == 0;
+}
+
+int request_parse(const char *line, const char *end, request *req) {
+	if (starts_with(line, end, "store", sizeof("store") - 1)) {
+		req->type = REQUEST_STORE;
+		const char *rest = quoted(line, end, &req->key, &req->key_len);
+		quoted(rest, end, &req->value, &req->value_len);
+	} else if (starts_with(line, end, "retrieve", sizeof("retrieve") - 1)) {
+		req->type = REQUEST_RETRIEVE;
+		quoted(line, end, &req->key, &req->key_len);
+	} else if (starts_with(line, end, "add_server",
+				sizeof("add_server") - 1)) {
+		req->type = REQUEST_ADD_SERVER;
+		req->server_id = number(line + sizeof("add_server") - 1, end);
+	} else if (starts_with(line, end, "remove_server",
+				sizeof("remove_server") - 1)) {
+		req->type = REQUEST_REMOVE_SERVER;
+		req->server_id = number(line + sizeof("remove_server") - 1, end);
+	} else if (starts_with(line, end, "stats", sizeof("stats") - 1)) {
+		req->type = REQUEST_STATS;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+int input_next(input_file *input, request *req) {
+	if (input->pos >= input->size)
+		return 0;
+
+	// the lines before the current one are not needed anymore, so the
+	// resident memory doesn't grow with the size of the input
+	if (input->mapped && input->pos - input->released >= RELEASE_CHUNK) {
+		size_t page = sysconf(_SC_PAGESIZE);
+		size_t upto = input->pos / page * page;
+
+		madvise((char *)input->data + input->released,
+				upto - input->released, MADV_DONTNEED);
+		input->released = upto;
+	}
+
+	const char *line = input->data + input->pos;
+	const char *end = find(line, input->data + input->size, '\n');
+	input->pos = end - input->data + 1;
+
+	DIE(!request_parse(line, end, req), "unknown function call");
+	return 1;
+}
+
+void input_close(input_file *input) {
+	DIE(input == NULL, "No input to close");
+	if (input->mapped)
+		munmap((void *)input->data, input->size);
+	else
+		free((void *)input->data);
+	free(input);
+}
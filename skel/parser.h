@@ -0,0 +1,61 @@
+/* Copyright 2021 <> */
+#ifndef PARSER_H_
+#define PARSER_H_
+
+#include <stddef.h>
+
+typedef struct input_file input_file;
+typedef struct request request;
+
+typedef enum request_type {
+	REQUEST_STORE,
+	REQUEST_RETRIEVE,
+	REQUEST_ADD_SERVER,
+	REQUEST_REMOVE_SERVER,
+	REQUEST_STATS  // dumps the metrics of the load balancer
+} request_type;
+
+// A request of the input file. The key and the value point inside the
+// input (they don't end with '\0') and stay valid until it is closed
+struct request {
+	request_type type;
+	const char *key;
+	unsigned int key_len;
+	const char *value;
+	unsigned int value_len;
+	int server_id;
+};
+
+/**
+ * input_open() - Maps a file of requests in memory.
+ * @arg1: Path of the file.
+ *
+ * Files which can't be mapped (e.g. pipes) are read whole instead.
+ * Return: the input or NULL if the file can't be opened.
+ */
+input_file* input_open(const char *path);
+
+/**
+ * input_next() - Parses the next line of the input.
+ * @arg1: Input file.
+ * @arg2: This function will RETURN the request via this parameter.
+ *
+ * Every line is tokenized in a single pass, without copying anything.
+ * Return: 1 if a request was read, 0 at the end of the input.
+ */
+int input_next(input_file *input, request *req);
+
+void input_close(input_file *input);
+
+/**
+ * request_parse() - Parses a single line of requests.
+ * @arg1: Start of the line.
+ * @arg2: End of the line (its '\n' or the end of the data).
+ * @arg3: This function will RETURN the request via this parameter.
+ *
+ * The key and the value point inside the line.
+ * Return: 1 if a request was read, 0 if the line is not a request.
+ */
+int request_parse(const char *line, const char *end, request *req);
+
+#endif  /* PARSER_H_ */
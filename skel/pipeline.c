@@ -0,0 +1,342 @@
+/* Copyright 2021 <> */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "load_balancer.h"
+#include "pipeline.h"
+#include "utils.h"
+
+// Slots of every queue (a power of 2)
+#define QUEUE_SLOTS 4096
+// Retrieved values up to this size are copied in the result itself
+#define INLINE_VALUE 48
+// Times a waiting thread checks again before it gives up the CPU
+#define SPINS 64
+
+// Ring of fixed size items with a single producer and a single consumer.
+// Each side remembers the last position of the other one it saw, so the
+// line of the other side is only read when the queue looks full (or empty)
+typedef struct spsc_queue {
+	unsigned long long tail;  // Written by the producer
+	unsigned long long head_seen;
+	char pad1[64 - 2 * sizeof(unsigned long long)];
+	unsigned long long head;  // Written by the consumer
+	unsigned long long tail_seen;
+	char pad2[64 - 2 * sizeof(unsigned long long)];
+	char *items;
+	size_t item_size;
+} spsc_queue;
+
+typedef enum work_type {
+	WORK_STORE,
+	WORK_RETRIEVE,
+	WORK_END
+} work_type;
+
+// A request routed to an executor
+typedef struct work_item {
+	work_type type;
+	lb_route route;
+	const char *key;
+	unsigned int key_len;
+	const char *value;
+	unsigned int value_len;
+} work_item;
+
+// The result of a retrieve, copied before the executor goes on
+typedef struct result_item {
+	int found;
+	unsigned int value_len;
+	char *heap;  // Copy of a value which doesn't fit in value (or NULL)
+	char value[INLINE_VALUE];
+} result_item;
+
+typedef enum order_type {
+	ORDER_STORED,
+	ORDER_RETRIEVED,
+	ORDER_STATS,
+	ORDER_END
+} order_type;
+
+// A line of the results, in the order of the input. The result of a
+// store is known when it is routed, a retrieve waits for its executor
+typedef struct order_item {
+	order_type type;
+	int server_id;
+	unsigned int executor;
+	const char *text;  // The stored value, or the key of a retrieve
+	unsigned int len;
+} order_item;
+
+typedef struct pipeline pipeline;
+
+typedef struct executor {
+	spsc_queue work;
+	spsc_queue results;
+	pipeline *pipe;
+	pthread_t thread;
+	unsigned long long sent;  // Work items given to it (by the router)
+	char pad[64 - sizeof(unsigned long long)];
+	unsigned long long done;  // Work items it applied
+	char pad2[64 - sizeof(unsigned long long)];
+} executor;
+
+struct pipeline {
+	load_balancer *main;
+	output_buffer *out;
+	executor *executors;
+	unsigned int nexecutors;
+	spsc_queue order;
+	pthread_t sequencer;
+	unsigned long long ordered;  // Order items pushed (by the router)
+	char pad[64 - sizeof(unsigned long long)];
+	unsigned long long written;  // Order items the sequencer is done with
+};
+
+static void queue_init(spsc_queue *q, size_t item_size) {
+	memset(q, 0, sizeof(spsc_queue));
+	q->item_size = item_size;
+	q->items = malloc(QUEUE_SLOTS * item_size);
+	DIE(q->items == NULL, "Error allocating queue");
+}
+
+static void backoff(unsigned int *spins) {
+	if (++*spins < SPINS)
+		return;
+	*spins = 0;
+	sched_yield();
+}
+
+// Returns the slot of the next item, once there is room for it
+static void* queue_reserve(spsc_queue *q) {
+	unsigned int spins = 0;
+
+	while (q->tail - q->head_seen == QUEUE_SLOTS) {
+		q->head_seen = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+		if (q->tail - q->head_seen == QUEUE_SLOTS)
+			backoff(&spins);
+	}
+	return q->items + (q->tail % QUEUE_SLOTS) * q->item_size;
+}
+
+// Hands the reserved item to the consumer
+static void queue_publish(spsc_queue *q) {
+	__atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+}
+
+// Returns the oldest item, once there is one
+static void* queue_peek(spsc_queue *q) {
+	unsigned int spins = 0;
+
+	while (q->head == q->tail_seen) {
+		q->tail_seen = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+		if (q->head == q->tail_seen)
+			backoff(&spins);
+	}
+	return q->items + (q->head % QUEUE_SLOTS) * q->item_size;
+}
+
+// Gives the slot of the oldest item back to the producer
+static void queue_release(spsc_queue *q) {
+	__atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+}
+
+static void* executor_loop(void *arg) {
+	executor *e = arg;
+	load_balancer *main = e->pipe->main;
+
+	while (1) {
+		work_item *work = queue_peek(&e->work);
+
+		if (work->type == WORK_END) {
+			queue_release(&e->work);
+			return NULL;
+		}
+		if (work->type == WORK_STORE) {
+			loader_store_routed(main, &work->route, work->key, work->key_len,
+								work->value, work->value_len);
+		} else {
+			unsigned int value_len;
+			char *value = loader_retrieve_routed(main, &work->route,
+									work->key, work->key_len, &value_len);
+			result_item *result = queue_reserve(&e->results);
+
+			// the value changes with the next store of the key
+			result->found = value != NULL;
+			result->heap = NULL;
+			if (value) {
+				result->value_len = value_len;
+				char *copy = result->value;
+				if (result->value_len > INLINE_VALUE) {
+					result->heap = malloc(result->value_len);
+					DIE(result->heap == NULL, "Error copying a value");
+					copy = result->heap;
+				}
+				memcpy(copy, value, result->value_len);
+			}
+			queue_publish(&e->results);
+		}
+		queue_release(&e->work);
+		__atomic_store_n(&e->done, e->done + 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void* sequencer_loop(void *arg) {
+	pipeline *pipe = arg;
+
+	while (1) {
+		order_item *order = queue_peek(&pipe->order);
+
+		if (order->type == ORDER_END) {
+			queue_release(&pipe->order);
+			return NULL;
+		}
+		if (order->type == ORDER_STORED) {
+			output_stored(pipe->out, order->text, order->len, order->server_id);
+		} else if (order->type == ORDER_RETRIEVED) {
+			spsc_queue *results = &pipe->executors[order->executor].results;
+			result_item *result = queue_peek(results);
+
+			if (result->found)
+				output_retrieved(pipe->out, result->heap ? result->heap :
+								result->value, result->value_len,
+								order->server_id);
+			else
+				output_missing(pipe->out, order->text, order->len);
+			free(result->heap);
+			queue_release(results);
+		} else {
+			// the results before the metrics have to be written first
+			output_flush(pipe->out);
+			loader_print_stats(pipe->main, stdout);
+			fflush(stdout);
+		}
+		queue_release(&pipe->order);
+		__atomic_store_n(&pipe->written, pipe->written + 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void push_order(pipeline *pipe, order_type type, int server_id,
+					unsigned int executor, const char *text,
+					unsigned int len) {
+	order_item *order = queue_reserve(&pipe->order);
+
+	order->type = type;
+	order->server_id = server_id;
+	order->executor = executor;
+	order->text = text;
+	order->len = len;
+	queue_publish(&pipe->order);
+	pipe->ordered++;
+}
+
+// Waits until the executors applied every request sent to them
+static void wait_executors(pipeline *pipe) {
+	for (unsigned int i = 0; i < pipe->nexecutors; i++) {
+		executor *e = &pipe->executors[i];
+		unsigned int spins = 0;
+
+		while (__atomic_load_n(&e->done, __ATOMIC_ACQUIRE) != e->sent)
+			backoff(&spins);
+	}
+}
+
+// Waits until the sequencer wrote every result
+static void wait_sequencer(pipeline *pipe) {
+	unsigned int spins = 0;
+
+	while (__atomic_load_n(&pipe->written, __ATOMIC_ACQUIRE) != pipe->ordered)
+		backoff(&spins);
+}
+
+// Routes a store or a retrieve to the executor of its server
+static void dispatch(pipeline *pipe, const request *req) {
+	lb_route route;
+	loader_route_n(pipe->main, req->key, req->key_len, &route);
+	unsigned int poz = (unsigned int)route.server_id % pipe->nexecutors;
+	executor *e = &pipe->executors[poz];
+
+	work_item *work = queue_reserve(&e->work);
+	work->type = req->type == REQUEST_STORE ? WORK_STORE : WORK_RETRIEVE;
+	work->route = route;
+	work->key = req->key;
+	work->key_len = req->key_len;
+	work->value = req->value;
+	work->value_len = req->value_len;
+	queue_publish(&e->work);
+	e->sent++;
+
+	if (req->type == REQUEST_STORE)
+		push_order(pipe, ORDER_STORED, route.server_id, poz, req->value,
+				req->value_len);
+	else
+		push_order(pipe, ORDER_RETRIEVED, route.server_id, poz, req->key,
+				req->key_len);
+}
+
+void pipeline_run(input_file *input, output_buffer *out,
+				unsigned int executors) {
+	DIE(executors == 0, "Error - the pipeline needs an executor");
+	lb_config config;
+	init_lb_config(&config);
+	config.thread_safe = 1;
+
+	pipeline *pipe = calloc(1, sizeof(pipeline));
+	DIE(pipe == NULL, "Error allocating pipeline");
+	pipe->main = init_load_balancer_config(&config);
+	pipe->out = out;
+	pipe->nexecutors = executors;
+	pipe->executors = calloc(executors, sizeof(executor));
+	DIE(pipe->executors == NULL, "Error allocating executors");
+	queue_init(&pipe->order, sizeof(order_item));
+	for (unsigned int i = 0; i < executors; i++) {
+		executor *e = &pipe->executors[i];
+
+		e->pipe = pipe;
+		queue_init(&e->work, sizeof(work_item));
+		queue_init(&e->results, sizeof(result_item));
+		DIE(pthread_create(&e->thread, NULL, executor_loop, e),
+			"Error starting executor");
+	}
+	DIE(pthread_create(&pipe->sequencer, NULL, sequencer_loop, pipe),
+		"Error starting sequencer");
+
+	request req;
+	while (input_next(input, &req)) {
+		if (req.type == REQUEST_STORE || req.type == REQUEST_RETRIEVE) {
+			dispatch(pipe, &req);
+		} else if (req.type == REQUEST_ADD_SERVER) {
+			// the routes of the requests before it are still valid
+			wait_executors(pipe);
+			loader_add_server(pipe->main, req.server_id);
+		} else if (req.type == REQUEST_REMOVE_SERVER) {
+			wait_executors(pipe);
+			loader_remove_server(pipe->main, req.server_id);
+		} else {
+			wait_executors(pipe);
+			push_order(pipe, ORDER_STATS, 0, 0, NULL, 0);
+			wait_sequencer(pipe);
+		}
+	}
+
+	for (unsigned int i = 0; i < executors; i++) {
+		work_item *work = queue_reserve(&pipe->executors[i].work);
+
+		work->type = WORK_END;
+		queue_publish(&pipe->executors[i].work);
+	}
+	push_order(pipe, ORDER_END, 0, 0, NULL, 0);
+	pthread_join(pipe->sequencer, NULL);
+	for (unsigned int i = 0; i < executors; i++) {
+		pthread_join(pipe->executors[i].thread, NULL);
+		free(pipe->executors[i].work.items);
+		free(pipe->executors[i].results.items);
+	}
+	free(pipe->order.items);
+	free(pipe->executors);
+	free_load_balancer(pipe->main);
+	free(pipe);
+}
@@ -0,0 +1,24 @@
+/* Copyright 2021 <> */
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include "output.h"
+#include "parser.h"
+
+/**
+ * pipeline_run() - Applies the requests of a file on many threads.
+ * @arg1: Input file.
+ * @arg2: Writer of the results.
+ * @arg3: Number of executor threads.
+ *
+ * The calling thread parses the requests and routes their keys. Every
+ * server belongs to one executor, which applies its stores and retrieves
+ * in the order of the file, and a sequencer thread writes the results in
+ * that order too, so they are the same as those of the serial driver.
+ * Adding or removing a server (and the stats) waits for the executors
+ * to apply every request before it.
+ */
+void pipeline_run(input_file *input, output_buffer *out,
+				unsigned int executors);
+
+#endif  /* PIPELINE_H_ */
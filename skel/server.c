@@ -1,11 +1,24 @@
 /* Copyright 2021 <> */
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "server.h"
 #include "utils.h"
 
-#define NMAX 100
+// Initial number of slots (a power of 2 and a multiple of GROUP_SIZE)
+#define NMAX 16
+// The control bytes of a group of slots are probed together in a word
+#define GROUP_SIZE 8
+// Control byte of a slot that was never used / of a removed object,
+// a full slot stores a 7 bit tag of the key hash instead
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
+#define LSBS 0x0101010101010101ull
+#define MSBS 0x8080808080808080ull
+// A span of the hash index is split in two when it grows over SPAN_MAX
+#define SPAN_MAX 64
+#define SPANS_INIT 4
 
 int
 compare_function_strings(void *a, void *b)
@@ -19,132 +32,879 @@ compare_function_strings(void *a, void *b)
 unsigned int
 hash_function_string(void *a)
 {
-	/*
-	 * Credits: http://www.cse.yorku.ca/~oz/hash.html
-	 */
-	unsigned char *puchar_a = (unsigned char*) a;
-	unsigned long hash = 5381;
-	int c;
-
-	while ((c = *puchar_a++))
-		hash = ((hash << 5u) + hash) + c; /* hash * 33 + c */
+	return hash_djb2(a, strlen(a));
+}
 
-	return hash;
+// Hash of a stored key, the same one the load balancer used to route it
+static unsigned int key_hash(server_memory* server, const char* key) {
+	return server->hash(key, strlen(key));
 }
 
 server_memory* init_server_memory() {
+	server_memory *server = init_server_memory_shared(slab_create(0));
+
+	server->owns_slab = 1;
+	return server;
+}
+
+server_memory* init_server_memory_shared(slab_allocator* slab) {
 	server_memory *server = malloc(sizeof(server_memory));  // allocating a new server
 	DIE(server == NULL, "Error creating server");  // checking if we had enough memory on heap
+	DIE(slab == NULL, "No slab allocator for the server");
+	server->slab = slab;
+	server->owns_slab = 0;
+	server->hash = hash_djb2;
+	DIE(pthread_rwlock_init(&server->lock, NULL), "Error creating server lock");
 
-	// initial settings for the server (number of buckets, initial size)
+	// initial settings for the server (number of slots, initial size)
 	server->hmax = NMAX;
 	server->size = 0;
+	server->used = 0;
+	server->reads = 0;
 
-	server->buckets = malloc(server->hmax * sizeof(linked_list_t *));
-	DIE(server->buckets == NULL, "Error allocating buckets");
-	for (int i = 0; i < server->hmax; i++)
-		server->buckets[i] = ll_create(sizeof(info_obj));  // each bucket is a linked list
+	server->ctrl = malloc(server->hmax);
+	DIE(server->ctrl == NULL, "Error allocating control bytes");
+	memset(server->ctrl, CTRL_EMPTY, server->hmax);
+	server->slots = malloc(server->hmax * sizeof(info_obj *));
+	DIE(server->slots == NULL, "Error allocating slots");
 
+	// the hash index starts with one empty span covering the whole ring
+	server->spans_cap = SPANS_INIT;
+	server->nspans = 1;
+	server->span_low = malloc(server->spans_cap * sizeof(unsigned int));
+	DIE(server->span_low == NULL, "Error allocating hash index");
+	server->spans = calloc(server->spans_cap, sizeof(hash_span));
+	DIE(server->spans == NULL, "Error allocating hash index");
+	server->span_low[0] = 0;
+
+	server->snap_base = NULL;
+	server->snap = NULL;
+	server->snap_count = 0;
+	server->snap_live = 0;
+	server->snap_dead = NULL;
 	return server;
 }
 
-// I used the direct-chaining method to combat collisions
-void server_store(server_memory* server, char* key, char* value) {
-	DIE(server == NULL, "No server in store function");  // checking if I have a valid server
-	int index_value = hash_function_string(key) % server->hmax;  // where I have to add the entry
-	// If I already have this entry I just update its value
-	if (server_has_key(server, key) == 1) {
-		ll_node_t *curr = server->buckets[index_value]->head;
-		while(compare_function_strings(key, ((info_obj *)(curr->data))->key) != 0)
-			curr = curr->next;
-		memcpy(((info_obj *)(curr->data))->value, value, strlen(value) - 1);
+// The key hash is mixed before it is used by the table, because djb2 keeps
+// similar keys close together
+static unsigned int mix_hash(unsigned int hash) {
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+static uint64_t load_group(const unsigned char *ctrl) {
+	uint64_t group;
+
+	memcpy(&group, ctrl, sizeof(group));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	group = __builtin_bswap64(group);
+#endif
+	return group;
+}
+
+// Every slot of the group with the given tag has its high bit set in the
+// result (it may have false positives, the keys are compared anyway)
+static uint64_t match_tag(uint64_t group, unsigned char tag) {
+	uint64_t x = group ^ (LSBS * tag);
+
+	return (x - LSBS) & ~x & MSBS;
+}
+
+static uint64_t match_empty(uint64_t group) {
+	return group & (~group << 6) & MSBS;
+}
+
+static uint64_t match_free(uint64_t group) {
+	return group & (~group << 7) & MSBS;
+}
+
+static unsigned int first_slot(uint64_t match) {
+	return __builtin_ctzll(match) / 8;
+}
+
+// Returns the slot which stores the key or -1 if the key is not stored
+static int table_find(server_memory* server, const char* key,
+					unsigned int key_len, unsigned int hash) {
+	unsigned int mixed = mix_hash(hash);
+	unsigned int mask = server->hmax / GROUP_SIZE - 1;
+	unsigned int group = mixed & mask;
+	unsigned char tag = mixed >> 25;
+
+	while (1) {
+		uint64_t ctrl = load_group(server->ctrl + group * GROUP_SIZE);
+
+		for (uint64_t match = match_tag(ctrl, tag); match; match &= match - 1) {
+			unsigned int slot = group * GROUP_SIZE + first_slot(match);
+
+			const info_obj *obj = server->slots[slot];
+
+			// the stored hash rejects most other keys without reading them
+			if (server->ctrl[slot] == tag && obj->hash == hash &&
+				obj->key_len == key_len &&
+				memcmp(obj->data, key, key_len) == 0)
+				return slot;
+		}
+		// a key is never stored after an empty slot of its probe sequence
+		if (match_empty(ctrl))
+			return -1;
+		group = (group + 1) & mask;
+	}
+}
+
+// Returns the slot of a stored object: the addresses are compared, so
+// no key is read
+static int table_find_obj(server_memory* server, const info_obj *obj) {
+	unsigned int mixed = mix_hash(obj->hash);
+	unsigned int mask = server->hmax / GROUP_SIZE - 1;
+	unsigned int group = mixed & mask;
+	unsigned char tag = mixed >> 25;
+
+	while (1) {
+		uint64_t ctrl = load_group(server->ctrl + group * GROUP_SIZE);
+
+		for (uint64_t match = match_tag(ctrl, tag); match; match &= match - 1) {
+			unsigned int slot = group * GROUP_SIZE + first_slot(match);
+
+			if (server->ctrl[slot] == tag && server->slots[slot] == obj)
+				return slot;
+		}
+		DIE(match_empty(ctrl), "Error - the object is not stored here");
+		group = (group + 1) & mask;
+	}
+}
+
+// Places an object in the first free slot of its probe sequence
+static void table_place(server_memory* server, info_obj *obj,
+						unsigned int hash) {
+	unsigned int mixed = mix_hash(hash);
+	unsigned int mask = server->hmax / GROUP_SIZE - 1;
+	unsigned int group = mixed & mask;
+
+	while (1) {
+		uint64_t match = match_free(load_group(server->ctrl +
+											group * GROUP_SIZE));
+		if (match) {
+			unsigned int slot = group * GROUP_SIZE + first_slot(match);
+
+			if (server->ctrl[slot] == CTRL_EMPTY)
+				server->used++;
+			server->ctrl[slot] = mixed >> 25;
+			server->slots[slot] = obj;
+			return;
+		}
+		group = (group + 1) & mask;
+	}
+}
+
+// Rebuilds the table with hmax slots, dropping the deleted slots
+static void table_resize(server_memory* server, unsigned int hmax) {
+	unsigned char *old_ctrl = server->ctrl;
+	info_obj **old_slots = server->slots;
+	unsigned int old_hmax = server->hmax;
+
+	server->hmax = hmax;
+	server->used = 0;
+	server->ctrl = malloc(hmax);
+	DIE(server->ctrl == NULL, "Error growing control bytes");
+	memset(server->ctrl, CTRL_EMPTY, hmax);
+	server->slots = malloc(hmax * sizeof(info_obj *));
+	DIE(server->slots == NULL, "Error growing slots");
+
+	for (unsigned int i = 0; i < old_hmax; i++)
+		if (!(old_ctrl[i] & CTRL_EMPTY))
+			table_place(server, old_slots[i], old_slots[i]->hash);
+	free(old_ctrl);
+	free(old_slots);
+}
+
+// Grows the table once before extra objects are linked to it, instead
+// of doubling it again and again while they come
+static void table_reserve(server_memory* server, unsigned int extra) {
+	unsigned long long live = server->size - server->snap_live + extra;
+	unsigned int hmax = server->hmax;
+
+	while (live * 8 > hmax * 7ull)
+		hmax *= 2;
+	if (hmax != server->hmax)
+		table_resize(server, hmax);
+}
+
+// Returns the span which covers a key hash (the last one with low <= hash)
+static unsigned int span_search(server_memory* server, unsigned int hash) {
+	const unsigned int *base = server->span_low;
+	unsigned int len = server->nspans;
+
+	while (len > 1) {
+		unsigned int half = len / 2;
+		base += (base[half - 1] <= hash) ? half : 0;
+		len -= half;
+	}
+	// base is the first span with a greater low hash (or the last one)
+	return (base - server->span_low) + (*base <= hash) - 1;
+}
+
+static void span_push(hash_span *span, info_obj *obj) {
+	if (span->count == span->cap) {
+		span->cap = span->cap ? 2 * span->cap : 8;
+		span->items = realloc(span->items, span->cap * sizeof(info_obj *));
+		DIE(span->items == NULL, "Error growing hash span");
+	}
+	span->items[span->count++] = obj;
+}
+
+// Makes room for a new span on position poz
+static void span_insert(server_memory* server, unsigned int poz,
+						unsigned int low) {
+	if (server->nspans == server->spans_cap) {
+		server->spans_cap *= 2;
+		server->span_low = realloc(server->span_low,
+							server->spans_cap * sizeof(unsigned int));
+		DIE(server->span_low == NULL, "Error growing hash index");
+		server->spans = realloc(server->spans,
+							server->spans_cap * sizeof(hash_span));
+		DIE(server->spans == NULL, "Error growing hash index");
+	}
+	memmove(server->span_low + poz + 1, server->span_low + poz,
+			(server->nspans - poz) * sizeof(unsigned int));
+	memmove(server->spans + poz + 1, server->spans + poz,
+			(server->nspans - poz) * sizeof(hash_span));
+	server->span_low[poz] = low;
+	memset(&server->spans[poz], 0, sizeof(hash_span));
+	server->nspans++;
+}
+
+// Moves the upper half (by key hash) of a full span into a new span
+static void span_split(server_memory* server, unsigned int poz) {
+	hash_span *span = &server->spans[poz];
+
+	// the hash of the middle object becomes the low hash of the new span
+	info_obj **items = span->items;
+	unsigned int low = items[span->count / 2]->hash, lower = 0, higher = 0;
+	for (unsigned int i = 0; i < span->count; i++) {
+		lower += items[i]->hash < low;
+		higher += items[i]->hash > low;
+	}
+	// if that is also the smallest hash, split above it instead
+	if (lower == 0) {
+		if (higher == 0)
+			return;  // all the keys have the same hash
+		unsigned int next = 0xffffffffu;
+		for (unsigned int i = 0; i < span->count; i++)
+			if (items[i]->hash > low && items[i]->hash < next)
+				next = items[i]->hash;
+		low = next;
+	}
+
+	span_insert(server, poz + 1, low);
+	span = &server->spans[poz];
+	unsigned int kept = 0;
+	for (unsigned int i = 0; i < span->count; i++) {
+		if (items[i]->hash >= low)
+			span_push(&server->spans[poz + 1], items[i]);
+		else
+			items[kept++] = items[i];
+	}
+	span->count = kept;
+}
+
+static void index_add(server_memory* server, info_obj *obj,
+					unsigned int hash) {
+	unsigned int poz = span_search(server, hash);
+
+	span_push(&server->spans[poz], obj);
+	if (server->spans[poz].count > SPAN_MAX)
+		span_split(server, poz);
+}
+
+static void index_remove(server_memory* server, info_obj *obj,
+						unsigned int hash) {
+	unsigned int poz = span_search(server, hash);
+	hash_span *span = &server->spans[poz];
+
+	for (unsigned int i = 0; i < span->count; i++) {
+		if (span->items[i] == obj) {
+			span->items[i] = span->items[--span->count];
+			break;
+		}
+	}
+
+	// an empty span is merged into the one before it
+	if (span->count == 0 && server->nspans > 1) {
+		free(span->items);
+		memmove(server->span_low + poz, server->span_low + poz + 1,
+				(server->nspans - poz - 1) * sizeof(unsigned int));
+		memmove(server->spans + poz, server->spans + poz + 1,
+				(server->nspans - poz - 1) * sizeof(hash_span));
+		server->nspans--;
+		server->span_low[0] = 0;
+	}
+}
+
+static void snap_materialize(server_memory* server);
+
+// Collects the objects whose key hash is in [first, last], returns how
+// many were found (objs has to be freed by the caller)
+static unsigned int collect_range(server_memory* server, unsigned int first,
+								unsigned int last, info_obj ***objs) {
+	// the objects of a snapshot are about to move, so they need a table
+	snap_materialize(server);
+	unsigned int from = span_search(server, first);
+	unsigned int to = span_search(server, last);
+
+	unsigned int found = 0, max_found = 0;
+	for (unsigned int poz = from; poz <= to; poz++)
+		max_found += server->spans[poz].count;
+	*objs = NULL;
+	if (max_found == 0)
+		return 0;
+	*objs = malloc(max_found * sizeof(info_obj *));
+	DIE(*objs == NULL, "Error collecting a range of objects");
+
+	for (unsigned int poz = from; poz <= to; poz++) {
+		hash_span *span = &server->spans[poz];
+		unsigned int span_last = poz + 1 < server->nspans ?
+								server->span_low[poz + 1] - 1 : 0xffffffffu;
+
+		if (server->span_low[poz] >= first && span_last <= last) {
+			// the whole span is inside the arc
+			memcpy(*objs + found, span->items,
+					span->count * sizeof(info_obj *));
+			found += span->count;
+			continue;
+		}
+		// only the spans at the ends of the arc need the key hashes
+		for (unsigned int i = 0; i < span->count; i++) {
+			unsigned int hash = span->items[i]->hash;
+
+			if (hash >= first && hash <= last)
+				(*objs)[found++] = span->items[i];
+		}
+	}
+	return found;
+}
+
+static void index_replace(server_memory* server, info_obj *old,
+						info_obj *obj, unsigned int hash) {
+	hash_span *span = &server->spans[span_search(server, hash)];
+
+	for (unsigned int i = 0; i < span->count; i++) {
+		if (span->items[i] == old) {
+			span->items[i] = obj;
+			break;
+		}
+	}
+}
+
+void server_for_range(server_memory* server, unsigned int first,
+					unsigned int last, void (*visit)(info_obj*, void*),
+					void *arg) {
+	DIE(server == NULL, "No server in server_for_range");
+	info_obj **objs;
+	unsigned int found = collect_range(server, first, last, &objs);
+
+	for (unsigned int i = 0; i < found; i++)
+		visit(objs[i], arg);
+	free(objs);
+}
+
+// Takes an object out of the table and of the hash index (without freeing it)
+static void server_unlink(server_memory* server, int slot, unsigned int hash) {
+	info_obj *obj = server->slots[slot];
+
+	// if the group still has an empty slot, no probe sequence goes past it,
+	// so the slot can become empty again instead of deleted
+	unsigned int group = slot / GROUP_SIZE;
+	if (match_empty(load_group(server->ctrl + group * GROUP_SIZE))) {
+		server->ctrl[slot] = CTRL_EMPTY;
+		server->used--;
+	} else {
+		server->ctrl[slot] = CTRL_DELETED;
+	}
+	index_remove(server, obj, hash);
+	server->size--;
+}
+
+// Adds an object which is not stored yet to the table and the hash index
+static void server_link(server_memory* server, info_obj *obj,
+						unsigned int hash) {
+	// the table grows at 7/8 load (or only drops the deleted slots
+	// if they are the problem)
+	if ((server->used + 1) * 8ull > server->hmax * 7ull)
+		table_resize(server, (server->size - server->snap_live) * 2 >=
+								server->hmax ?
+								server->hmax * 2 : server->hmax);
+
+	server->size++;
+	table_place(server, obj, hash);
+	index_add(server, obj, hash);
+}
+
+static int value_spilled(unsigned int value_len) {
+	return value_len > VALUE_INLINE;
+}
+
+// The info_obj, the key and the value (or the address of the value)
+static unsigned int obj_size(unsigned int key_len, unsigned int value_len) {
+	return sizeof(info_obj) + key_len + 1 +
+		(value_spilled(value_len) ? sizeof(char *) : value_len + 1);
+}
+
+const char* info_key(const info_obj* obj) {
+	return obj->data;
+}
+
+char* info_value(const info_obj* obj) {
+	const char *value = obj->data + obj->key_len + 1;
+	char *spill;
+
+	if (!value_spilled(obj->value_len))
+		return (char *)value;
+	memcpy(&spill, value, sizeof(spill));
+	return spill;
+}
+
+// Copies a long value in an allocation of its own
+static void set_spill(server_memory* server, info_obj *obj, const char* value,
+					unsigned int value_len) {
+	char *spill = slab_alloc(server->slab, value_len + 1);
+
+	memcpy(spill, value, value_len);
+	spill[value_len] = '\0';
+	memcpy(obj->data + obj->key_len + 1, &spill, sizeof(spill));
+}
+
+static info_obj *new_obj(server_memory* server, const char* key,
+						unsigned int key_len, const char* value,
+						unsigned int value_len, unsigned int hash) {
+	info_obj *obj = slab_alloc(server->slab, obj_size(key_len, value_len));
+
+	obj->hash = hash;
+	obj->key_len = key_len;
+	obj->value_len = value_len;
+	memcpy(obj->data, key, key_len);
+	obj->data[key_len] = '\0';
+	if (value_spilled(value_len)) {
+		set_spill(server, obj, value, value_len);
 	} else {
-		// otherwise I create a new entry
-		info_obj add;
+		memcpy(obj->data + key_len + 1, value, value_len);
+		obj->data[key_len + 1 + value_len] = '\0';
+	}
+	return obj;
+}
+
+static void free_obj(server_memory* server, info_obj *obj) {
+	if (value_spilled(obj->value_len))
+		slab_free(server->slab, info_value(obj), obj->value_len + 1);
+	slab_free(server->slab, obj, obj_size(obj->key_len, obj->value_len));
+}
+
+// Stores a new value in an object without moving it, if its memory
+// stays in the same size class. Returns 0 if a new object is needed
+static int replace_value(server_memory* server, info_obj *obj,
+						const char* value, unsigned int value_len) {
+	unsigned int old_len = obj->value_len;
+
+	if (value_spilled(old_len) != value_spilled(value_len))
+		return 0;
+	if (value_spilled(value_len)) {
+		char *spill = info_value(obj);
+
+		// only the value is reallocated, the object keeps its place
+		if (slab_usable(value_len + 1) != slab_usable(old_len + 1)) {
+			slab_free(server->slab, spill, old_len + 1);
+			set_spill(server, obj, value, value_len);
+		} else {
+			memcpy(spill, value, value_len);
+			spill[value_len] = '\0';
+		}
+	} else {
+		if (slab_usable(obj_size(obj->key_len, value_len)) !=
+			slab_usable(obj_size(obj->key_len, old_len)))
+			return 0;
+		memcpy(obj->data + obj->key_len + 1, value, value_len);
+		obj->data[obj->key_len + 1 + value_len] = '\0';
+	}
+	obj->value_len = value_len;
+	return 1;
+}
+
+static int snap_dropped(server_memory* server, unsigned int index) {
+	return server->snap_dead &&
+		(server->snap_dead[index / 8] & (1u << (index % 8)));
+}
+
+// Returns the entry of the snapshot which still holds the key or -1
+static int snap_find(server_memory* server, const char* key,
+					unsigned int key_len, unsigned int hash) {
+	if (server->snap_live == 0)
+		return -1;
+
+	// the first entry with the hash, then the ones with the same hash
+	unsigned int low = 0, high = server->snap_count;
+	while (low < high) {
+		unsigned int mid = low + (high - low) / 2;
+
+		if (server->snap[mid].hash < hash)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	for (; low < server->snap_count && server->snap[low].hash == hash; low++) {
+		const snap_entry *entry = &server->snap[low];
+
+		if (snap_dropped(server, low))
+			continue;
+		if (entry->key_len == key_len &&
+			memcmp(server->snap_base + entry->offset, key, key_len) == 0)
+			return low;
+	}
+	return -1;
+}
+
+// The entry is replaced or removed: it is skipped from now on
+static void snap_drop(server_memory* server, unsigned int index) {
+	if (server->snap_dead == NULL) {
+		server->snap_dead = calloc((server->snap_count + 7) / 8, 1);
+		DIE(server->snap_dead == NULL, "Error allocating snapshot bitmap");
+	}
+	server->snap_dead[index / 8] |= 1u << (index % 8);
+	server->snap_live--;
+	server->size--;
+}
+
+// Copies the entries still in use into the table and detaches the file
+static void snap_materialize(server_memory* server) {
+	if (server->snap == NULL)
+		return;
+
+	unsigned int live = server->snap_live, hmax = server->hmax;
+	while (server->size * 8ull > hmax * 7ull)
+		hmax *= 2;
+	if (hmax != server->hmax)
+		table_resize(server, hmax);
+
+	server->size -= live;
+	server->snap_live = 0;
+	for (unsigned int i = 0; i < server->snap_count; i++) {
+		const snap_entry *entry = &server->snap[i];
+		const char *key = server->snap_base + entry->offset;
+
+		if (snap_dropped(server, i))
+			continue;
+		server_link(server, new_obj(server, key, entry->key_len,
+									key + entry->key_len + 1,
+									entry->value_len, entry->hash),
+					entry->hash);
+	}
+	free(server->snap_dead);
+	server->snap_base = NULL;
+	server->snap = NULL;
+	server->snap_count = 0;
+	server->snap_dead = NULL;
+}
+
+// Hands an object over to another server
+static void move_obj(server_memory* dst, server_memory* src, info_obj *obj,
+					unsigned int hash) {
+	unsigned int key_len = obj->key_len;
+
+	DIE(dst->hash != src->hash, "Error - moving between different hashes");
+	server_unlink(src, table_find_obj(src, obj), hash);
+	// a key is stored only once, but an older copy would be replaced
+	int slot = table_find(dst, obj->data, key_len, hash);
+	if (slot >= 0) {
+		info_obj *old = dst->slots[slot];
+
+		server_unlink(dst, slot, hash);
+		free_obj(dst, old);
+	} else if ((slot = snap_find(dst, obj->data, key_len, hash)) >= 0) {
+		snap_drop(dst, slot);
+	}
+	// the memory of the object can only change hands inside an allocator
+	if (dst->slab != src->slab) {
+		info_obj *copy = new_obj(dst, obj->data, key_len, info_value(obj),
+								obj->value_len, hash);
+
+		free_obj(src, obj);
+		obj = copy;
+	}
+	server_link(dst, obj, hash);
+}
 
-		// allocate memory for its fields
-		add.key = malloc(strlen(key) - 1);
-		DIE(add.key == NULL, "Error");
-		add.value = malloc(strlen(value) - 1);
-		DIE(add.value == NULL, "Error");
+void server_move_range(server_memory* dst, server_memory* src,
+					unsigned int first, unsigned int last) {
+	DIE(dst == NULL || src == NULL, "No server in server_move_range");
+	info_obj **objs;
+	unsigned int found = collect_range(src, first, last, &objs);
 
-		// deep copy the data
-		memcpy(add.key, key, strlen(key) - 1);
-		memcpy(add.value, value, strlen(value) - 1);
+	table_reserve(dst, found);
+	for (unsigned int i = 0; i < found; i++)
+		move_obj(dst, src, objs[i], objs[i]->hash);
+	free(objs);
+}
+
+void server_move_object(server_memory* dst, server_memory* src,
+						info_obj* obj) {
+	DIE(dst == NULL || src == NULL, "No server in server_move_object");
+	move_obj(dst, src, obj, obj->hash);
+}
+
+unsigned int server_move_if(server_memory* src,
+							server_memory* (*owner)(unsigned int, void*),
+							void *arg) {
+	DIE(src == NULL, "No server in server_move_if");
+	info_obj **objs;
+	unsigned int found = collect_range(src, 0, 0xffffffffu, &objs);
+	unsigned int moved = 0;
 
-		// increase the number of items in the server and add it to the bucket
-		server->size++;
-		ll_add_nth_node(server->buckets[index_value], 0, &add);
+	for (unsigned int i = 0; i < found; i++) {
+		unsigned int hash = objs[i]->hash;
+		server_memory *dst = owner(hash, arg);
+
+		if (dst != src) {
+			move_obj(dst, src, objs[i], hash);
+			moved++;
+		}
 	}
+	free(objs);
+	return moved;
+}
+
+// I used open addressing, probing the control bytes of 8 slots at once
+void server_store(server_memory* server, char* key, char* value) {
+	server_store_n(server, key, strlen(key), value, strlen(value),
+				key_hash(server, key));
+}
+
+void server_store_n(server_memory* server, const char* key,
+					unsigned int key_len, const char* value,
+					unsigned int value_len, unsigned int hash) {
+	DIE(server == NULL, "No server in store function");  // checking if I have a valid server
+	int slot = table_find(server, key, key_len, hash);
+	// If I already have this entry I just update its value
+	if (slot >= 0) {
+		info_obj *old = server->slots[slot];
+
+		if (replace_value(server, old, value, value_len))
+			return;
+		info_obj *add = new_obj(server, key, key_len, value, value_len, hash);
+		server->slots[slot] = add;
+		index_replace(server, old, add, hash);
+		free_obj(server, old);
+		return;
+	}
+
+	// otherwise I create a new entry (the object, its key and its value
+	// are a single allocation) and add it to the table; it replaces the
+	// entry of a snapshot with the same key
+	slot = snap_find(server, key, key_len, hash);
+	if (slot >= 0)
+		snap_drop(server, slot);
+	server_link(server, new_obj(server, key, key_len, value, value_len, hash),
+				hash);
 }
 
 void server_remove(server_memory* server, char* key) {
+	server_remove_n(server, key, strlen(key), key_hash(server, key));
+}
+
+void server_remove_n(server_memory* server, const char* key,
+					unsigned int key_len, unsigned int hash) {
 	DIE(server == NULL, "No server in server_remove");
-	int index_value = hash_function_string(key) % server->hmax;  // the index from where I have to delete the entry
-	int rem_nr = 0;  // the index in the list that I have to remove
-	if (server_has_key(server, key) == 0)
+	int slot = table_find(server, key, key_len, hash);
+	if (slot < 0) {
+		slot = snap_find(server, key, key_len, hash);
+		if (slot >= 0)
+			snap_drop(server, slot);
 		return;  // if the key doesn't exit, I don't have what to remove
-	ll_node_t *curr = server->buckets[index_value]->head;
-	while (curr != NULL)
-	{
-		// search for the desired element in the list and get its position
-		rem_nr++;
-		if (compare_function_strings(key, ((info_obj *)(curr->data))->key) == 0)
-			break;
-		curr = curr->next;
 	}
+	info_obj *obj = server->slots[slot];
+
 	// remove the element and free its memory
-	curr = ll_remove_nth_node(server->buckets[index_value], rem_nr);
-	free(((info_obj *)(curr->data))->key);
-	free(((info_obj *)(curr->data))->value);
-	free(curr->data);
-	free(curr);
-	server->size--;
+	server_unlink(server, slot, hash);
+	free_obj(server, obj);
 }
 
 char* server_retrieve(server_memory* server, char* key) {
+	return server_retrieve_n(server, key, strlen(key),
+							key_hash(server, key), NULL);
+}
+
+char* server_retrieve_n(server_memory* server, const char* key,
+						unsigned int key_len, unsigned int hash,
+						unsigned int* value_len) {
 	DIE(server == NULL, "No server in server_retrieve");  // checking if I have a valid server
-	int index_value = hash_function_string(key) % server->hmax;  // the index from where I have to retrieve the value
-	ll_node_t *curr = server->buckets[index_value]->head;
-	if (curr == NULL)
-		return NULL;  // if the list is empty
-	while (curr != NULL) {
-		// searching for the desired entry
-		if (compare_function_strings(key, ((info_obj *)(curr->data))->key) == 0)
-			return ((info_obj *)(curr->data))->value;
-		curr = curr->next;
+	int slot = table_find(server, key, key_len, hash);
+	if (slot >= 0) {
+		if (value_len)
+			*value_len = server->slots[slot]->value_len;
+		return info_value(server->slots[slot]);
 	}
-	return NULL;  // if I don't have any entries with that hash
+
+	// the value may still be in the snapshot (after its key)
+	slot = snap_find(server, key, key_len, hash);
+	if (slot < 0)
+		return NULL;  // if I don't have any entries with that key
+	if (value_len)
+		*value_len = server->snap[slot].value_len;
+	return (char *)server->snap_base + server->snap[slot].offset +
+			key_len + 1;
+}
+
+void server_prefetch(server_memory* server, unsigned int hash) {
+	unsigned int mask = server->hmax / GROUP_SIZE - 1;
+	unsigned int group = mix_hash(hash) & mask;
+
+	// the first group of the probe sequence and its objects
+	__builtin_prefetch(server->ctrl + group * GROUP_SIZE);
+	__builtin_prefetch(server->slots + group * GROUP_SIZE);
+}
+
+void server_set_hash(server_memory* server, hash_fn hash) {
+	DIE(server == NULL || hash == NULL, "No server in server_set_hash");
+	DIE(server->size != 0, "Error - the hash of a server changes while empty");
+	server->hash = hash;
 }
 
 void free_server_memory(server_memory* server) {
 	DIE(server == NULL, "No server in free_server_memory");
-	for (int i = 0; i < server->hmax; i++) {
-		ll_node_t *curr;
-
-		while (server->buckets[i]->size > 0) {
-			curr == ll_remove_nth_node(server->buckets[i], 0);
-			free(((info_obj *)(curr->data))->key);
-			free(((info_obj *)(curr->data))->value);
-			free(curr->data);
-			free(curr);
+	if (!server->owns_slab) {
+		// the objects go back to the shared allocator
+		for (unsigned int i = 0; i < server->hmax; i++) {
+			if (server->ctrl[i] & CTRL_EMPTY)
+				continue;  // empty or deleted slot
+			free_obj(server, server->slots[i]);
 		}
-		free(server->buckets[i]);
+	} else {
+		// all the objects are freed at once with the allocator
+		slab_destroy(server->slab);
 	}
-	free(server->buckets);
+	free_server_tables(server);
+}
+
+void free_server_tables(server_memory* server) {
+	DIE(server == NULL, "No server in free_server_tables");
+	pthread_rwlock_destroy(&server->lock);
+	free(server->snap_dead);
+	free(server->ctrl);
+	free(server->slots);
+	for (unsigned int i = 0; i < server->nspans; i++)
+		free(server->spans[i].items);
+	free(server->spans);
+	free(server->span_low);
 	free(server);
 }
 
+void server_get_stats(server_memory* server, server_stats* stats) {
+	DIE(server == NULL || stats == NULL, "No server in server_get_stats");
+	unsigned int mask = server->hmax / GROUP_SIZE - 1;
+
+	memset(stats, 0, sizeof(server_stats));
+	stats->keys = server->size;
+	stats->slots = server->hmax;
+	stats->tombstones = server->used - (server->size - server->snap_live);
+	for (unsigned int i = 0; i < server->hmax; i++) {
+		if (server->ctrl[i] & CTRL_EMPTY)
+			continue;  // empty or deleted slot
+		info_obj *obj = server->slots[i];
+		unsigned int home = mix_hash(obj->hash) & mask;
+		unsigned int probe = ((i / GROUP_SIZE) - home) & mask;
+
+		stats->bytes += slab_usable(obj_size(obj->key_len, obj->value_len));
+		if (value_spilled(obj->value_len))
+			stats->bytes += slab_usable(obj->value_len + 1);
+		stats->probes[probe < PROBE_BUCKETS ? probe : PROBE_BUCKETS - 1]++;
+	}
+}
+
 // function that returns 1 if the key exists in the server and 0 otherwise
 int server_has_key(server_memory* server, char* key) {
 	DIE(server == NULL, "No server in server_has_key");
-	int index_value = hash_function_string(key) % server->hmax;
-	ll_node_t *curr = server->buckets[index_value]->head;
-	if (curr == NULL)
-		return 0;
-	while (curr != NULL) {
-		if (compare_function_strings(key, ((info_obj *)(curr->data))->key) == 0)
-			return 1;
-		curr = curr->next;
+	unsigned int key_len = strlen(key), hash = key_hash(server, key);
+
+	return table_find(server, key, key_len, hash) >= 0 ||
+		snap_find(server, key, key_len, hash) >= 0;
+}
+
+void server_attach_snapshot(server_memory* server, const char* base,
+							const snap_entry* entries, unsigned int count) {
+	DIE(server == NULL || base == NULL, "No server in server_attach_snapshot");
+	DIE(server->size != 0, "Error - a snapshot is attached to an empty server");
+	server->snap_base = base;
+	server->snap = entries;
+	server->snap_count = count;
+	server->snap_live = count;
+	server->size = count;
+}
+
+// An object which is written to a snapshot
+typedef struct snap_item {
+	unsigned int hash;
+	unsigned int key_len;
+	unsigned int value_len;
+	const char *key;
+	const char *value;
+} snap_item;
+
+static int compare_snap_items(const void *a, const void *b) {
+	unsigned int hash_a = ((const snap_item *)a)->hash;
+	unsigned int hash_b = ((const snap_item *)b)->hash;
+
+	return (hash_a > hash_b) - (hash_a < hash_b);
+}
+
+int server_write_snapshot(server_memory* server, FILE* out) {
+	DIE(server == NULL || out == NULL, "No server in server_write_snapshot");
+	long long start = ftello(out);
+	if (start < 0)
+		return -1;
+
+	// the objects of the table and the entries of an older snapshot
+	// which are still in use, in ring order
+	unsigned int count = 0;
+	snap_item *items = malloc((server->size + 1) * sizeof(snap_item));
+	DIE(items == NULL, "Error allocating snapshot items");
+	for (unsigned int i = 0; i < server->hmax; i++) {
+		if (server->ctrl[i] & CTRL_EMPTY)
+			continue;  // empty or deleted slot
+		info_obj *obj = server->slots[i];
+
+		items[count++] = (snap_item){obj->hash, obj->key_len, obj->value_len,
+									obj->data, info_value(obj)};
+	}
+	for (unsigned int i = 0; i < server->snap_count; i++) {
+		const snap_entry *entry = &server->snap[i];
+		const char *key = server->snap_base + entry->offset;
+
+		if (snap_dropped(server, i))
+			continue;
+		items[count++] = (snap_item){entry->hash, entry->key_len,
+									entry->value_len, key,
+									key + entry->key_len + 1};
+	}
+	qsort(items, count, sizeof(snap_item), compare_snap_items);
+
+	int error = 0;
+	unsigned long long offset = start + (unsigned long long)count *
+								sizeof(snap_entry);
+	for (unsigned int i = 0; i < count && !error; i++) {
+		snap_entry entry = {items[i].hash, items[i].key_len,
+							items[i].value_len, 0, offset};
+
+		error = fwrite(&entry, sizeof(entry), 1, out) != 1;
+		offset += items[i].key_len + 1 + items[i].value_len + 1;
 	}
+	// the keys and values keep their '\0', so they are read in place
+	for (unsigned int i = 0; i < count && !error; i++)
+		error = fwrite(items[i].key, items[i].key_len + 1, 1, out) != 1 ||
+				fwrite(items[i].value, items[i].value_len + 1, 1, out) != 1;
+	static const char zeros[8];
+	if (!error && offset % 8)
+		error = fwrite(zeros, 8 - offset % 8, 1, out) != 1;
+	free(items);
+	return error ? -1 : 0;
 }
@@ -2,31 +2,140 @@
 #ifndef SERVER_H_
 #define SERVER_H_
 
-#include "LinkedList.h"
+#include <pthread.h>
+#include <stdio.h>
+
+#include "hash.h"
+#include "slab.h"
 
 typedef struct server_memory server_memory;
 typedef struct info_obj info_obj;
+typedef struct hash_span hash_span;
+typedef struct snap_entry snap_entry;
+
+// A span of the hash index: the objects whose key hash is between
+// the low hash of the span and the low hash of the next span
+struct hash_span {
+	info_obj **items;  // Objects of the span (in no particular order)
+	unsigned int count;  // Number of objects in the span
+	unsigned int cap;  // Allocated size of items
+};
+
+// An object in a snapshot file: its key and its value (both ended with
+// '\0') are stored one after the other at offset
+struct snap_entry {
+	unsigned int hash;
+	unsigned int key_len;
+	unsigned int value_len;
+	unsigned int pad;
+	unsigned long long offset;  // From the start of the file
+};
 
 struct server_memory {
-	linked_list_t **buckets;  // Array of linked lists
+	unsigned char *ctrl;  // Control byte of each slot (empty, deleted or tag)
+	info_obj **slots;  // Objects stored in the open addressing table
 	unsigned int size;  // Current number of elements stored
-	unsigned int hmax;  // Number of buckets
+	unsigned int hmax;  // Number of slots (a power of 2)
+	unsigned int used;  // Number of slots which are not empty
+	slab_allocator *slab;  // Memory of the objects (shared between servers)
+	int owns_slab;  // 1 if the allocator is freed with the server
+	hash_fn hash;  // Hash of the keys (hash_djb2 unless it is set)
+	pthread_rwlock_t lock;  // Taken by the load balancer in thread-safe mode
+	// Reads the load balancer routed to it (not counted in thread-safe
+	// mode), replicated keys are read from the replica with the fewest
+	unsigned long long reads;
 	// int (*compare_function)(void*, void*);  // Function that compares 2 keys
+
+	// Index of the objects ordered by key hash (i.e. by ring position),
+	// used to find the objects of an arc of the hash ring
+	unsigned int *span_low;  // Sorted low hashes, span_low[0] is always 0
+	hash_span *spans;  // The spans, in the same order as span_low
+	unsigned int nspans;  // Number of spans
+	unsigned int spans_cap;  // Allocated number of spans
+
+	// Objects restored from a snapshot are read from the mapped file
+	// until a store, a remove or a move changes them
+	const char *snap_base;  // Start of the mapped file
+	const snap_entry *snap;  // Entries of the server, sorted by hash
+	unsigned int snap_count;
+	unsigned int snap_live;  // Entries still in use (counted in size)
+	unsigned char *snap_dead;  // Bit i is set once entry i was replaced
 };
 
+// Number of buckets of the probe length histogram of a server
+#define PROBE_BUCKETS 8
+
+// Figures about a server, computed when they are asked for
+typedef struct server_stats {
+	unsigned int keys;
+	unsigned long long bytes;  // Memory taken by the objects
+	unsigned int slots;
+	unsigned int tombstones;  // Deleted slots which still end no probe
+	// probes[i]: keys found in the (i + 1)th group of their probe
+	// sequence (the last bucket counts all the longer probes)
+	unsigned int probes[PROBE_BUCKETS];
+} server_stats;
+
+// Longest value stored inside its object, the longer ones are kept in
+// an allocation of their own and the object only holds their address
+#define VALUE_INLINE 256
+
+// An object is a single allocation: its lengths, then its key and its
+// value right after them, so a lookup reads one line to compare the key
 struct info_obj {
-	char *key;
-	char *value;
+	// Hash of the key, kept so that moves and resizes never hash it again
+	unsigned int hash;
+	unsigned int key_len;
+	unsigned int value_len;
+	// The key and a '\0', then the value and a '\0' (or the address of
+	// a value longer than VALUE_INLINE, unaligned)
+	char data[];
 };
 
+// Returns the key of an object (it ends with '\0')
+const char* info_key(const info_obj* obj);
+
+// Returns the value of an object (it ends with '\0')
+char* info_value(const info_obj* obj);
+
 int compare_function_strings(void *a, void *b);
 
 unsigned int hash_function_string(void *a);
 
 server_memory* init_server_memory();
 
+/**
+ * init_server_memory_shared() - Creates a server which uses an allocator
+ *                               shared with other servers.
+ * @arg1: Allocator of the objects (it must outlive the server).
+ *
+ * Objects are moved between servers of the same allocator without
+ * copying their memory.
+ */
+server_memory* init_server_memory_shared(slab_allocator* slab);
+
+/**
+ * server_set_hash() - Changes the hash of the keys of an empty server.
+ * @arg1: Server (it must not store any object yet).
+ * @arg2: Hash of the keys.
+ *
+ * The hash index keeps the objects in ring order, so a server must use
+ * the same hash as the load balancer which routes the keys to it (and
+ * objects only move between servers with the same hash).
+ */
+void server_set_hash(server_memory* server, hash_fn hash);
+
 void free_server_memory(server_memory* server);
 
+/**
+ * free_server_tables() - Frees a server but not the memory of its objects.
+ * @arg1: Server to be freed.
+ *
+ * Used when the shared allocator is destroyed right after, which
+ * frees all the objects at once.
+ */
+void free_server_tables(server_memory* server);
+
 /**
  * server_store() - Stores a key-value pair to the server.
  * @arg1: Server which performs the task.
@@ -52,6 +161,134 @@ void server_remove(server_memory* server, char* key);
  */
 char* server_retrieve(server_memory* server, char* key);
 
+/**
+ * server_store_n() - Stores a key-value pair given as slices of memory.
+ * @arg1: Server which performs the task.
+ * @arg2: Key (it doesn't have to end with '\0').
+ * @arg3: Length of the key.
+ * @arg4: Value (it doesn't have to end with '\0').
+ * @arg5: Length of the value.
+ * @arg6: Hash of the key (see server_set_hash()).
+ */
+void server_store_n(server_memory* server, const char* key,
+					unsigned int key_len, const char* value,
+					unsigned int value_len, unsigned int hash);
+
+void server_remove_n(server_memory* server, const char* key,
+					unsigned int key_len, unsigned int hash);
+
+/**
+ * server_retrieve_n() - Gets the value of a key given as a slice.
+ * @arg1: Server which performs the task.
+ * @arg2: Key (it doesn't have to end with '\0').
+ * @arg3: Length of the key.
+ * @arg4: Hash of the key (see server_set_hash()).
+ * @arg5: This function will RETURN the length of the value via this
+ *        parameter when the key is found (NULL if not needed).
+ *
+ * Return: the value (ended with '\0') or NULL if the key does not exist.
+ */
+char* server_retrieve_n(server_memory* server, const char* key,
+						unsigned int key_len, unsigned int hash,
+						unsigned int* value_len);
+
+/**
+ * server_prefetch() - Starts loading the slots where a key hash is probed.
+ * @arg1: Server which will be asked for the key.
+ * @arg2: Hash of the key (see server_set_hash()).
+ *
+ * Called a few keys ahead of a batch, so the cache misses overlap.
+ */
+void server_prefetch(server_memory* server, unsigned int hash);
+
 int server_has_key(server_memory* server, char* key);
 
+/**
+ * server_attach_snapshot() - Serves the objects of a snapshot.
+ * @arg1: Empty server.
+ * @arg2: Start of the mapped snapshot file (it must outlive the server).
+ * @arg3: Entries of the server in the file, sorted by hash.
+ * @arg4: Number of entries.
+ *
+ * The entries are not copied: retrieves search them in the file and
+ * return values which point inside it. An entry is only copied into the
+ * table when the server moves it to another server (or when its key is
+ * stored again, which replaces it).
+ */
+void server_attach_snapshot(server_memory* server, const char* base,
+							const snap_entry* entries, unsigned int count);
+
+/**
+ * server_write_snapshot() - Writes the objects of a server to a snapshot.
+ * @arg1: Server which is saved (it is not changed).
+ * @arg2: File, at the position where the entries start (a multiple of 8).
+ *
+ * Writes server->size entries sorted by hash, then the keys and values
+ * they point to, padded to a multiple of 8 bytes.
+ * Return: 0 on success, -1 if the file could not be written.
+ */
+int server_write_snapshot(server_memory* server, FILE* out);
+
+/**
+ * server_get_stats() - Measures a server.
+ * @arg1: Server which is measured.
+ * @arg2: This function will RETURN the figures via this parameter.
+ *
+ * Walks the whole table, so it costs as much as a scan of the server.
+ */
+void server_get_stats(server_memory* server, server_stats* stats);
+
+/**
+ * server_for_range() - Visits the objects stored in an arc of the ring.
+ * @arg1: Server which performs the task.
+ * @arg2: First key hash of the arc.
+ * @arg3: Last key hash of the arc (inclusive, first <= last).
+ * @arg4: Function called for every object whose key hash is in the arc.
+ * @arg5: Argument passed to the function.
+ *
+ * The objects are collected before the first call, so the function
+ * may move or remove them. The cost depends on the number of objects
+ * in the arc, not on the number of objects stored on the server.
+ */
+void server_for_range(server_memory* server, unsigned int first,
+					unsigned int last, void (*visit)(info_obj*, void*),
+					void *arg);
+
+/**
+ * server_move_range() - Moves the objects of an arc to another server.
+ * @arg1: Server which receives the objects.
+ * @arg2: Server which gives the objects.
+ * @arg3: First key hash of the arc.
+ * @arg4: Last key hash of the arc (inclusive, first <= last).
+ *
+ * The objects are handed over as they are: the keys and values
+ * are not copied again.
+ */
+void server_move_range(server_memory* dst, server_memory* src,
+					unsigned int first, unsigned int last);
+
+/**
+ * server_move_object() - Moves a single object to another server.
+ * @arg1: Server which receives the object.
+ * @arg2: Server which stores the object.
+ * @arg3: The object (e.g. one visited by server_for_range()).
+ *
+ * The object is unlinked and linked again as it is, like the objects
+ * of server_move_range().
+ */
+void server_move_object(server_memory* dst, server_memory* src,
+						info_obj* obj);
+
+/**
+ * server_move_if() - Moves every object which belongs to another server.
+ * @arg1: Server which gives the objects.
+ * @arg2: Function which returns the server that owns a key hash.
+ * @arg3: Argument passed to the function.
+ *
+ * Return: the number of objects which were moved.
+ */
+unsigned int server_move_if(server_memory* src,
+							server_memory* (*owner)(unsigned int, void*),
+							void *arg);
+
 #endif  /* SERVER_H_ */
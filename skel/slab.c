@@ -0,0 +1,198 @@
+/* Copyright 2021 <> */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+#include "utils.h"
+
+#define SLAB_SIZE (2u << 20)
+// 16 byte steps up to 128, then 4 classes for every power of 2
+#define SMALL_CLASSES 8
+#define SMALL_MAX 128
+#define MAX_POWER 16
+#define NR_CLASSES (SMALL_CLASSES + (MAX_POWER - 6) * 4)
+
+typedef struct slab slab;
+struct slab {
+	slab *next;  // The slabs are kept in a list to be freed at once
+};
+
+// Objects too big for a size class come from malloc with this header
+typedef struct big_obj big_obj;
+struct big_obj {
+	big_obj *prev;
+	big_obj *next;
+};
+
+struct slab_allocator {
+	void *free_list[NR_CLASSES];  // Freed objects of every size class
+	char *bump;  // Next unused byte of the current slab
+	char *bump_end;  // End of the current slab
+	slab *slabs;  // All the slabs of the allocator
+	big_obj *big;  // All the big objects which were not freed
+	int huge_pages;  // Try to use huge pages for new slabs
+	int threads;  // 1 once slab_enable_threads() was called
+	pthread_mutex_t lock;  // Taken by alloc and free when threads is 1
+};
+
+// Returns the size class of an allocation or -1 if it is too big for a slab
+static int size_class(unsigned int size) {
+	if (size <= SMALL_MAX)
+		return size <= 16 ? 0 : (size + 15) / 16 - 1;
+
+	// 2^p < size <= 2^(p + 1), split in 4 steps of 2^(p - 2)
+	int p = 63 - __builtin_clzll(size - 1);
+	if (p > MAX_POWER)
+		return -1;
+	return SMALL_CLASSES + (p - 7) * 4 + (((size - 1) >> (p - 2)) & 3);
+}
+
+static unsigned int class_size(int index) {
+	if (index < SMALL_CLASSES)
+		return 16 * (index + 1);
+	int p = 7 + (index - SMALL_CLASSES) / 4;
+	int k = (index - SMALL_CLASSES) % 4;
+	return (1u << p) + (k + 1) * (1u << (p - 2));
+}
+
+unsigned int slab_usable(unsigned int size) {
+	int index = size_class(size);
+
+	return index < 0 ? size : class_size(index);
+}
+
+slab_allocator* slab_create(int huge_pages) {
+	slab_allocator *alloc = calloc(1, sizeof(slab_allocator));
+	DIE(alloc == NULL, "Error creating slab allocator");
+
+	alloc->huge_pages = huge_pages;
+	return alloc;
+}
+
+static void new_slab(slab_allocator* alloc) {
+	void *mem = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+	if (alloc->huge_pages)
+		mem = mmap(NULL, SLAB_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if (mem == MAP_FAILED) {
+		mem = mmap(NULL, SLAB_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		DIE(mem == MAP_FAILED, "Error allocating slab");
+#ifdef MADV_HUGEPAGE
+		// without reserved huge pages, ask for transparent ones
+		if (alloc->huge_pages)
+			madvise(mem, SLAB_SIZE, MADV_HUGEPAGE);
+#endif
+	}
+
+	slab *header = mem;
+	header->next = alloc->slabs;
+	alloc->slabs = header;
+	alloc->bump = (char *)mem + 16;
+	alloc->bump_end = (char *)mem + SLAB_SIZE;
+}
+
+void slab_enable_threads(slab_allocator* alloc) {
+	DIE(alloc == NULL, "No slab allocator");
+	DIE(pthread_mutex_init(&alloc->lock, NULL), "Error creating slab lock");
+	alloc->threads = 1;
+}
+
+static void* alloc_object(slab_allocator* alloc, unsigned int size) {
+	int index = size_class(size);
+
+	if (index < 0) {
+		big_obj *big = malloc(sizeof(big_obj) + size);
+		DIE(big == NULL, "Error allocating a big object");
+		big->prev = NULL;
+		big->next = alloc->big;
+		if (alloc->big != NULL)
+			alloc->big->prev = big;
+		alloc->big = big;
+		return big + 1;
+	}
+
+	// reuse a freed object of the same class
+	void *obj = alloc->free_list[index];
+	if (obj != NULL) {
+		memcpy(&alloc->free_list[index], obj, sizeof(void *));
+		return obj;
+	}
+
+	// otherwise cut it from the current slab
+	unsigned int bytes = class_size(index);
+	if (alloc->bump == NULL || alloc->bump + bytes > alloc->bump_end)
+		new_slab(alloc);
+	obj = alloc->bump;
+	alloc->bump += bytes;
+	return obj;
+}
+
+void* slab_alloc(slab_allocator* alloc, unsigned int size) {
+	DIE(alloc == NULL, "No slab allocator");
+	if (!alloc->threads)
+		return alloc_object(alloc, size);
+
+	pthread_mutex_lock(&alloc->lock);
+	void *obj = alloc_object(alloc, size);
+	pthread_mutex_unlock(&alloc->lock);
+	return obj;
+}
+
+static void free_object(slab_allocator* alloc, void *ptr, unsigned int size) {
+	int index = size_class(size);
+
+	if (index < 0) {
+		big_obj *big = (big_obj *)ptr - 1;
+
+		if (big->prev != NULL)
+			big->prev->next = big->next;
+		else
+			alloc->big = big->next;
+		if (big->next != NULL)
+			big->next->prev = big->prev;
+		free(big);
+		return;
+	}
+	memcpy(ptr, &alloc->free_list[index], sizeof(void *));
+	alloc->free_list[index] = ptr;
+}
+
+void slab_free(slab_allocator* alloc, void *ptr, unsigned int size) {
+	DIE(alloc == NULL, "No slab allocator");
+	if (ptr == NULL)
+		return;
+	if (!alloc->threads) {
+		free_object(alloc, ptr, size);
+		return;
+	}
+
+	pthread_mutex_lock(&alloc->lock);
+	free_object(alloc, ptr, size);
+	pthread_mutex_unlock(&alloc->lock);
+}
+
+void slab_destroy(slab_allocator* alloc) {
+	DIE(alloc == NULL, "No slab allocator");
+	while (alloc->slabs != NULL) {
+		slab *next = alloc->slabs->next;
+
+		munmap(alloc->slabs, SLAB_SIZE);
+		alloc->slabs = next;
+	}
+	while (alloc->big != NULL) {
+		big_obj *next = alloc->big->next;
+
+		free(alloc->big);
+		alloc->big = next;
+	}
+	if (alloc->threads)
+		pthread_mutex_destroy(&alloc->lock);
+	free(alloc);
+}
@@ -0,0 +1,55 @@
+/* Copyright 2021 <> */
+#ifndef SLAB_H_
+#define SLAB_H_
+
+typedef struct slab_allocator slab_allocator;
+
+/**
+ * slab_create() - Creates an allocator for small objects.
+ * @arg1: 1 to back the slabs with huge pages (when the system has them).
+ *
+ * The memory is cut from 2 MB slabs in size classes; freed objects are
+ * kept on a free list per class and handed out again.
+ */
+slab_allocator* slab_create(int huge_pages);
+
+/**
+ * slab_destroy() - Frees all the memory of the allocator at once.
+ * @arg1: Allocator to be destroyed.
+ *
+ * The objects which were not freed are released too.
+ */
+void slab_destroy(slab_allocator* slab);
+
+/**
+ * slab_alloc() - Allocates an object (never returns NULL).
+ * @arg1: Allocator which gives the memory.
+ * @arg2: Size of the object in bytes.
+ */
+void* slab_alloc(slab_allocator* slab, unsigned int size);
+
+/**
+ * slab_free() - Gives an object back to its size class.
+ * @arg1: Allocator which gave the memory.
+ * @arg2: The object.
+ * @arg3: Size used when the object was allocated
+ *        (or any size with the same slab_usable()).
+ */
+void slab_free(slab_allocator* slab, void *ptr, unsigned int size);
+
+/**
+ * slab_enable_threads() - Makes the allocator safe to use from many threads.
+ * @arg1: Allocator used by several threads from now on.
+ *
+ * Allocations and frees are serialised by a lock; without this call
+ * the allocator takes no locks at all.
+ */
+void slab_enable_threads(slab_allocator* slab);
+
+/**
+ * slab_usable() - Returns how many bytes an allocation of a size gets.
+ * @arg1: Size of the object in bytes.
+ */
+unsigned int slab_usable(unsigned int size);
+
+#endif  /* SLAB_H_ */
@@ -0,0 +1,131 @@
+/* Copyright 2021 <> */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+#include "utils.h"
+
+#ifdef LB_STATS
+// Load balancers a thread remembers its counters of
+#define LOCAL_SLOTS 4
+
+// The counters of a thread which used the load balancer. They are kept
+// after the thread exits, so its work is still counted
+typedef struct stats_node {
+	lb_stats stats;
+	pthread_t owner;
+	struct stats_node *next;
+} stats_node;
+
+struct lb_stats_set {
+	// Never reused, unlike the address of a freed set
+	unsigned long long id;
+	stats_node *nodes;
+	pthread_mutex_t lock;
+};
+
+typedef struct stats_local_slot {
+	unsigned long long id;  // Of the set, 0 for none
+	lb_stats *stats;
+} stats_local_slot;
+
+static unsigned long long next_id = 1;
+static __thread stats_local_slot local_stats[LOCAL_SLOTS];
+
+lb_stats_set* stats_create(void) {
+	lb_stats_set *set = calloc(1, sizeof(lb_stats_set));
+	DIE(set == NULL, "Error allocating stats");
+
+	set->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+	DIE(pthread_mutex_init(&set->lock, NULL), "Error creating stats lock");
+	return set;
+}
+
+void stats_free(lb_stats_set *set) {
+	if (set == NULL)
+		return;
+	while (set->nodes) {
+		stats_node *next = set->nodes->next;
+
+		free(set->nodes);
+		set->nodes = next;
+	}
+	pthread_mutex_destroy(&set->lock);
+	free(set);
+}
+
+lb_stats* stats_local(lb_stats_set *set) {
+	stats_local_slot *slot = &local_stats[set->id % LOCAL_SLOTS];
+
+	if (slot->id != set->id) {
+		// a thread which exited may have had the same pthread_t, its
+		// counters are simply continued
+		pthread_mutex_lock(&set->lock);
+		stats_node *node = set->nodes;
+		while (node && !pthread_equal(node->owner, pthread_self()))
+			node = node->next;
+		if (node == NULL) {
+			node = calloc(1, sizeof(stats_node));
+			DIE(node == NULL, "Error allocating stats");
+			node->owner = pthread_self();
+			node->next = set->nodes;
+			set->nodes = node;
+		}
+		pthread_mutex_unlock(&set->lock);
+		slot->id = set->id;
+		slot->stats = &node->stats;
+	}
+	return slot->stats;
+}
+
+unsigned long long stats_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void stats_latency(lb_stats_set *set, lb_op op, unsigned long long start) {
+	unsigned long long ns = stats_now() - start;
+	int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+	if (bucket >= LB_LATENCY_BUCKETS)
+		bucket = LB_LATENCY_BUCKETS - 1;
+	unsigned long long *count = &stats_local(set)->latency[op][bucket];
+
+	__atomic_store_n(count, *count + 1, __ATOMIC_RELAXED);
+}
+
+int stats_collect(lb_stats_set *set, lb_stats *total) {
+	DIE(set == NULL || total == NULL, "No stats to collect");
+	unsigned long long *sum = (unsigned long long *)total;
+	unsigned int n = sizeof(lb_stats) / sizeof(unsigned long long);
+
+	memset(total, 0, sizeof(lb_stats));
+	pthread_mutex_lock(&set->lock);
+	for (stats_node *node = set->nodes; node; node = node->next) {
+		unsigned long long *counts = (unsigned long long *)&node->stats;
+
+		for (unsigned int i = 0; i < n; i++)
+			sum[i] += __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&set->lock);
+	return 1;
+}
+#else
+lb_stats_set* stats_create(void) {
+	return NULL;
+}
+
+void stats_free(lb_stats_set *set) {
+	(void)set;
+}
+
+int stats_collect(lb_stats_set *set, lb_stats *total) {
+	(void)set;
+	DIE(total == NULL, "No stats to collect");
+	memset(total, 0, sizeof(lb_stats));
+	return 0;
+}
+#endif
@@ -0,0 +1,78 @@
+/* Copyright 2021 <> */
+#ifndef STATS_H_
+#define STATS_H_
+
+// Counters of a load balancer. They are only kept when it is built with
+// -DLB_STATS; otherwise the STATS_* macros compile to nothing
+typedef enum lb_counter {
+	LB_STAT_STORES,
+	LB_STAT_RETRIEVES,
+	LB_STAT_HITS,  // retrieves which found their key
+	LB_STAT_RING_SEARCHES,
+	LB_STAT_RING_STEPS,  // steps of the binary searches of the ring
+	LB_NR_COUNTERS
+} lb_counter;
+
+typedef enum lb_op {
+	LB_OP_STORE,
+	LB_OP_RETRIEVE,
+	LB_OP_ADD_SERVER,
+	LB_OP_REMOVE_SERVER,
+	LB_NR_OPS
+} lb_op;
+
+// Bucket i of a latency histogram counts the operations which took
+// [2^i, 2^(i+1)) nanoseconds
+#define LB_LATENCY_BUCKETS 40
+
+typedef struct lb_stats {
+	unsigned long long counters[LB_NR_COUNTERS];
+	unsigned long long latency[LB_NR_OPS][LB_LATENCY_BUCKETS];
+} lb_stats;
+
+// The counters of one load balancer, kept apart for every thread which
+// used it
+struct lb_stats_set;
+typedef struct lb_stats_set lb_stats_set;
+
+// Returns NULL when the counters are compiled out
+lb_stats_set* stats_create(void);
+
+void stats_free(lb_stats_set *set);
+
+#ifdef LB_STATS
+// The counters of the calling thread (no other thread writes them)
+lb_stats* stats_local(lb_stats_set *set);
+
+unsigned long long stats_now(void);
+
+void stats_latency(lb_stats_set *set, lb_op op, unsigned long long start);
+
+// Other threads read the counters while they are written, so the
+// updates are relaxed atomic stores (a plain add, without a lock)
+#define STATS_ADD(set, counter, n)                                          \
+	do {                                                                    \
+		unsigned long long *stats_counter_ =                                \
+			&stats_local(set)->counters[counter];                           \
+		__atomic_store_n(stats_counter_, *stats_counter_ + (n),             \
+						__ATOMIC_RELAXED);                                  \
+	} while (0)
+#define STATS_BEGIN() unsigned long long stats_start_ = stats_now()
+#define STATS_END(set, op) stats_latency(set, op, stats_start_)
+#else
+#define STATS_ADD(set, counter, n) do { (void)(set); } while (0)
+#define STATS_BEGIN() do {} while (0)
+#define STATS_END(set, op) do { (void)(set); } while (0)
+#endif
+
+/**
+ * stats_collect() - Adds up the counters of all the threads.
+ * @arg1: Counters of a load balancer.
+ * @arg2: This function will RETURN the sums via this parameter.
+ *
+ * Return: 1 if the counters are kept, 0 if they were compiled out
+ * (and the sums are all 0).
+ */
+int stats_collect(lb_stats_set *set, lb_stats *total);
+
+#endif  /* STATS_H_ */